@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "dca_conv.h"
+#include "fft.h"
+#include "parallel.h"
+
+/*
+	Measures how a sound's energy is spread over frequency, to find out
+	how much would be lost by lowering its sample rate.
+
+	Each channel is split into Hann windowed frames that overlap by half,
+	and the power spectra of all frames of all channels are summed. Two
+	frames are transformed at once, in the real and imaginary parts of
+	one complex FFT, and separated afterwards using the symmetry of the
+	spectra of real signals.
+
+	Frames are split into ranges that are summed on separate threads,
+	each into its own spectrum, which are then added together.
+*/
+
+//Never split frames into ranges shorter than this
+#define SPECTRUM_MIN_JOB_FRAMES	64
+
+typedef struct {
+	const DcAudioConverter *dcac;
+	const dcaFft *fft;
+	const float *window;
+	//Frames per channel, and frames summed by each job
+	size_t frame_cnt;
+	unsigned job_cnt;
+	//job_cnt spectra of bin_cnt bins each
+	double *job_power;
+	unsigned bin_cnt;
+	bool failed;
+} SpectrumJobs;
+
+static void LoadFrame(const SpectrumJobs *jobs, size_t frame, float *dst) {
+	const DcAudioConverter *dcac = jobs->dcac;
+	const unsigned size = jobs->fft->size;
+	const unsigned c = frame / jobs->frame_cnt;
+	const size_t start = (frame % jobs->frame_cnt) * (size / 2);
+	const int16_t *src = dcac->samples[c];
+	for(unsigned i = 0; i < size; i++) {
+		float s = start + i < dcac->samples_len ? src[start + i] : 0;
+		dst[i*2] = s * jobs->window[i];
+	}
+}
+
+static void SumSpectrumRange(void *ctx, unsigned job) {
+	SpectrumJobs *jobs = ctx;
+	const unsigned size = jobs->fft->size;
+	const size_t total = jobs->frame_cnt * jobs->dcac->channel_cnt;
+	size_t first = total * job / jobs->job_cnt;
+	size_t last = total * (job + 1) / jobs->job_cnt;
+	double *power = jobs->job_power + (size_t)job * jobs->bin_cnt;
+	
+	dcaComplex *work = malloc(size * sizeof(dcaComplex));
+	if (work == NULL) {
+		__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+	
+	for(size_t frame = first; frame < last; frame += 2) {
+		//Frame pairs go in the real and imaginary parts. An odd frame out is paired with silence.
+		memset(work, 0, size * sizeof(dcaComplex));
+		LoadFrame(jobs, frame, &work[0].re);
+		if (frame + 1 < last)
+			LoadFrame(jobs, frame + 1, &work[0].im);
+		dcaFftForward(jobs->fft, work);
+		
+		for(unsigned k = 0; k < jobs->bin_cnt; k++) {
+			dcaComplex a = work[k], b = work[(size - k) & (size - 1)];
+			//X = (Z[k] + conj(Z[N-k])) / 2, Y = (Z[k] - conj(Z[N-k])) / 2i
+			double xr = (a.re + b.re) / 2, xi = (a.im - b.im) / 2;
+			double yr = (a.im + b.im) / 2, yi = (b.re - a.re) / 2;
+			power[k] += xr*xr + xi*xi + yr*yr + yi*yi;
+		}
+	}
+	
+	free(work);
+}
+
+dcaError dcaAnalyzeSpectrum(const DcAudioConverter *dcac, dcaSpectrum *spec) {
+	assert(dcac);
+	assert(spec);
+	assert(dcac->channel_cnt > 0);
+	memset(spec, 0, sizeof(*spec));
+	
+	const unsigned size = DCA_SPECTRUM_SIZE;
+	dcaFft fft;
+	if (!dcaFftInit(&fft, size))
+		return DCAE_OUT_OF_MEMORY;
+	
+	dcaError retval = DCAE_OUT_OF_MEMORY;
+	float *window = malloc(size * sizeof(float));
+	SpectrumJobs jobs = {
+		.dcac = dcac,
+		.fft = &fft,
+		.window = window,
+		.frame_cnt = dcac->samples_len / (size / 2) + 1,
+		.bin_cnt = size / 2 + 1,
+		.failed = false,
+	};
+	
+	size_t total = jobs.frame_cnt * dcac->channel_cnt;
+	jobs.job_cnt = dcaJobThreads();
+	if (jobs.job_cnt > total / SPECTRUM_MIN_JOB_FRAMES)
+		jobs.job_cnt = total / SPECTRUM_MIN_JOB_FRAMES;
+	if (jobs.job_cnt < 1)
+		jobs.job_cnt = 1;
+	
+	jobs.job_power = calloc((size_t)jobs.job_cnt * jobs.bin_cnt, sizeof(double));
+	spec->power = calloc(jobs.bin_cnt, sizeof(double));
+	if (window == NULL || jobs.job_power == NULL || spec->power == NULL)
+		goto cleanup;
+	
+	for(unsigned i = 0; i < size; i++)
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / size);
+	
+	dcaRunJobs(jobs.job_cnt, SumSpectrumRange, &jobs);
+	if (jobs.failed)
+		goto cleanup;
+	
+	spec->sample_rate_hz = dcac->sample_rate_hz;
+	spec->bin_cnt = jobs.bin_cnt;
+	for(unsigned j = 0; j < jobs.job_cnt; j++) {
+		for(unsigned k = 0; k < jobs.bin_cnt; k++) {
+			spec->power[k] += jobs.job_power[(size_t)j * jobs.bin_cnt + k];
+			spec->total += jobs.job_power[(size_t)j * jobs.bin_cnt + k];
+		}
+	}
+	retval = DCAE_OK;
+	
+cleanup:
+	if (retval != DCAE_OK)
+		dcaSpectrumFree(spec);
+	free(jobs.job_power);
+	free(window);
+	dcaFftFree(&fft);
+	return retval;
+}
+
+double dcaSpectrumFractionAbove(const dcaSpectrum *spec, double hz) {
+	assert(spec);
+	if (spec->total <= 0)
+		return 0;
+	
+	//Bin k is centered on k * rate / size. Bins straddling hz count by how much of them is above it.
+	double bin_hz = (double)spec->sample_rate_hz / DCA_SPECTRUM_SIZE;
+	double above = 0;
+	for(unsigned k = 0; k < spec->bin_cnt; k++) {
+		double lo = (k - 0.5) * bin_hz, hi = (k + 0.5) * bin_hz;
+		if (lo >= hz)
+			above += spec->power[k];
+		else if (hi > hz)
+			above += spec->power[k] * (hi - hz) / bin_hz;
+	}
+	return above / spec->total;
+}
+
+double dcaSpectrumBandwidth(const dcaSpectrum *spec, double max_fraction) {
+	assert(spec);
+	
+	//Take bins off the top until the next one would put too much energy above the cut
+	double bin_hz = (double)spec->sample_rate_hz / DCA_SPECTRUM_SIZE;
+	double limit = spec->total * max_fraction, above = 0;
+	for(unsigned k = spec->bin_cnt; k-- > 0; ) {
+		if (above + spec->power[k] > limit)
+			return (k + 0.5) * bin_hz;
+		above += spec->power[k];
+	}
+	return 0;
+}
+
+void dcaSpectrumFree(dcaSpectrum *spec) {
+	assert(spec);
+	free(spec->power);
+	memset(spec, 0, sizeof(*spec));
+}
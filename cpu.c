@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "util.h"
+
+/*
+	Instantiates kernels_impl.h once per instruction set. Every level
+	is built from the same C, so results only differ in speed. This file
+	is built with -ffp-contract=off so levels that have FMA round the
+	same way as the ones that don't.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DCACPU_X86
+#endif
+
+//Scalar reference, with vectorization disabled
+#pragma GCC push_options
+#pragma GCC optimize ("no-tree-vectorize")
+#define KERNEL_ISA	scalar
+#include "kernels_impl.h"
+#undef KERNEL_ISA
+#pragma GCC pop_options
+
+#ifdef DCACPU_X86
+#pragma GCC push_options
+#pragma GCC target ("sse2")
+#define KERNEL_ISA	sse2
+#include "kernels_impl.h"
+#undef KERNEL_ISA
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("sse4.1")
+#define KERNEL_ISA	sse41
+#include "kernels_impl.h"
+#undef KERNEL_ISA
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+#define KERNEL_ISA	avx2
+#include "kernels_impl.h"
+#undef KERNEL_ISA
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("avx512f,avx512bw,avx512vl")
+#define KERNEL_ISA	avx512
+#include "kernels_impl.h"
+#undef KERNEL_ISA
+#pragma GCC pop_options
+#endif
+
+dcaCpuKernels dcaCpu = {
+	.interleave = Interleave_scalar,
+	.deinterleave = Deinterleave_scalar,
+	.downmix = Downmix_scalar,
+	.find_loud = FindLoud_scalar,
+	.find_loud_reverse = FindLoudReverse_scalar,
+	.complex_multiply = ComplexMultiply_scalar,
+	.dot = Dot_scalar,
+	.fft_transform = FftTransform_scalar,
+};
+
+dcaCpuLevel dcaCpuDetect(void) {
+#ifdef DCACPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+		return DCACPU_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return DCACPU_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return DCACPU_SSE41;
+	if (__builtin_cpu_supports("sse2"))
+		return DCACPU_SSE2;
+#endif
+	return DCACPU_SCALAR;
+}
+
+dcaCpuLevel dcaCpuInit(dcaCpuLevel level) {
+	dcaCpuLevel supported = dcaCpuDetect();
+	if (level == DCACPU_AUTO) {
+		level = supported;
+	} else if (level > supported) {
+		dcaLog(LOG_WARNING, "CPU does not support %s, using %s\n", dcaCpuLevelName(level), dcaCpuLevelName(supported));
+		level = supported;
+	}
+	
+	switch(level) {
+#ifdef DCACPU_X86
+	case DCACPU_AVX512:
+		dcaCpu = kernels_avx512;
+		//GCC fuses the complex multiplies into vfmaddsub with AVX-512 even with
+		//-ffp-contract=off, which changes rounding. The AVX2 versions don't use FMA.
+		dcaCpu.complex_multiply = kernels_avx2.complex_multiply;
+		dcaCpu.fft_transform = kernels_avx2.fft_transform;
+		break;
+	case DCACPU_AVX2:
+		dcaCpu = kernels_avx2;
+		break;
+	case DCACPU_SSE41:
+		dcaCpu = kernels_sse41;
+		break;
+	case DCACPU_SSE2:
+		dcaCpu = kernels_sse2;
+		break;
+#endif
+	default:
+		level = DCACPU_SCALAR;
+		dcaCpu = kernels_scalar;
+		break;
+	}
+	
+	dcaLog(LOG_INFO, "Using %s kernels\n", dcaCpuLevelName(level));
+	return level;
+}
+
+const char * dcaCpuLevelName(dcaCpuLevel level) {
+	static const char * names[] = {
+		[DCACPU_SCALAR] = "scalar",
+		[DCACPU_SSE2] = "sse2",
+		[DCACPU_SSE41] = "sse4.1",
+		[DCACPU_AVX2] = "avx2",
+		[DCACPU_AVX512] = "avx512",
+		[DCACPU_AUTO] = "auto",
+	};
+	
+	unsigned l = level;
+	if (l > DCACPU_AUTO)
+		l = DCACPU_AUTO;
+	return names[l];
+}
@@ -0,0 +1,59 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fft.h"
+
+/*
+	Runtime CPU dispatch for hot loops.
+
+	Each kernel is compiled once per instruction set level. dcaCpuInit
+	checks what the CPU supports and points dcaCpu at the best set. Until
+	dcaCpuInit is called, dcaCpu uses the scalar kernels.
+*/
+
+typedef enum {
+	DCACPU_SCALAR,
+	DCACPU_SSE2,
+	DCACPU_SSE41,
+	DCACPU_AVX2,
+	DCACPU_AVX512,
+	
+	//Use the best level the CPU supports
+	DCACPU_AUTO,
+} dcaCpuLevel;
+
+typedef struct {
+	//dst[i*channels+c] = src[c][offset+i]
+	void (*interleave)(int16_t *dst, int16_t * const *src, unsigned channels, size_t offset, size_t frames);
+	//dst[c][offset+i] = src[i*channels+c]
+	void (*deinterleave)(int16_t **dst, size_t offset, const int16_t *src, unsigned channels, size_t frames);
+	//Average of all channels, rounded down
+	void (*downmix)(int16_t *dst, int16_t * const *src, unsigned channels, size_t len);
+	
+	//Returns the first/last position in [start, end) where any channel has an absolute
+	//value greater than threshold, or end if there is none
+	size_t (*find_loud)(int16_t * const *samples, unsigned channels, size_t start, size_t end, int threshold);
+	size_t (*find_loud_reverse)(int16_t * const *samples, unsigned channels, size_t start, size_t end, int threshold);
+	
+	//a[i] *= b[i]
+	void (*complex_multiply)(dcaComplex *a, const dcaComplex *b, size_t n);
+	float (*dot)(const float *a, const float *b, size_t n);
+	//In place FFT, sign is 1 for forward and -1 for inverse
+	void (*fft_transform)(const dcaFft *fft, dcaComplex *data, float sign);
+} dcaCpuKernels;
+
+extern dcaCpuKernels dcaCpu;
+
+//Returns the best level supported by this CPU
+dcaCpuLevel dcaCpuDetect(void);
+
+//Binds dcaCpu to the kernels for the requested level. If the CPU does not support the
+//requested level, the best supported one is used instead. Returns the level used.
+dcaCpuLevel dcaCpuInit(dcaCpuLevel level);
+
+const char * dcaCpuLevelName(dcaCpuLevel level);
+
+#endif
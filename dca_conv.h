@@ -21,6 +21,20 @@
 */
 #define DCAC_MAX_SAMPLES	(64*1024-256)
 
+/*
+	Compressed inputs are decoded in blocks of this many interleaved
+	samples (shared between all channels), and appended to the planar
+	sample buffers as they are decoded.
+*/
+#define DCA_DECODE_BLOCK_SAMPLES	8192
+
+/*
+	Default block size in bytes for --interleave. A streamer typically
+	refills half of each channel's ring buffer at a time, so this is
+	half of a 16KB ring buffer.
+*/
+#define DCAC_DEFAULT_BLOCK_SIZE	8192
+
 typedef enum {
 	//The first three (PCM16, PCM8, and ADPCM) match up to the AICA's formats. Do not change this.
 	
@@ -30,8 +44,41 @@ typedef enum {
 	
 	//Guess format based on output file extension
 	DCAF_AUTO,
+	//Smallest format that meets a quality target, see --format auto-best
+	DCAF_AUTO_BEST,
 } dcaFormat;
 
+typedef enum {
+	//Pick resampler based on the conversion ratio
+	DCAR_AUTO,
+	//libsamplerate's best quality sinc converter
+	DCAR_SINC,
+	//FFT overlap-save filter, only used for downsampling
+	DCAR_FFT,
+} dcaResampler;
+
+typedef enum {
+	//Sample formats for .WAV output
+	DCAW_PCM16,
+	DCAW_PCM24,
+	DCAW_FLOAT,
+} dcaWavFormat;
+
+//Read only view of a whole input file, see mapfile.c
+typedef struct {
+	const void *data;
+	size_t size;
+	//True if data is mapped from the file, false if it was read into a malloc'd buffer
+	bool mapped;
+} dcaMappedFile;
+
+//A position in the source, see --range
+typedef struct {
+	double value;
+	//value is in seconds if set, otherwise in samples
+	bool seconds;
+} dcaPosition;
+
 typedef struct {
 	//sample rate of samples
 	unsigned sample_rate_hz;
@@ -41,6 +88,14 @@ typedef struct {
 	int16_t *samples[DCAC_MAX_CHANNELS];
 	//Size is in samples, not bytes. Size in bytes will always be this times sizeof(*samples[0])
 	size_t samples_len;
+	//Number of samples allocated per channel, only used while loading
+	size_t samples_capacity;
+	//Part of the source to load, see dcaGetRange. An end of 0 means the end of the source.
+	dcaPosition range_start, range_end;
+	//Bit c is set if samples[c] points into source instead of being allocated. Those channels
+	//are read only, and are released with dcaFreeChannel. Only PCM16 .DCA files are loaded this way.
+	unsigned borrowed_channels;
+	dcaMappedFile source;
 	
 	
 	//The following are used for output:
@@ -53,6 +108,12 @@ typedef struct {
 	unsigned desired_sample_rate_hz;
 	//Generate DCA file longer than DCAC_MAX_SAMPLES without downsampling
 	bool long_sound;
+	//If not 0, interleave the channels of a .DCA file in blocks of this many bytes (see DCA_FLAG_INTERLEAVED)
+	unsigned block_size;
+	//Resampling engine to use when changing sample rate
+	dcaResampler resampler;
+	//Sample format of .WAV files and previews
+	dcaWavFormat wav_format;
 	
 	bool looping;
 	unsigned loop_start, loop_end;
@@ -85,28 +146,229 @@ typedef enum {
 	
 	DCAE_WRITE_ERROR,
 	
+	DCAE_RESAMPLE_ERROR,
+	
+	DCAE_OUT_OF_MEMORY,
+	
+	//--range is past the end of the source
+	DCAE_BAD_RANGE,
+	
+	//Two sounds in a bank have the same name hash
+	DCAE_DUPLICATE_NAME,
+	
+	//Bank has no sounds, or more than it can index
+	DCAE_TOO_MANY_SOUNDS,
+	
 	DCAE_UNKNOWN,
 } dcaError;
 
-dcaError fDcaLoad(DcAudioConverter *dcac, const char *fname);
-dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname);
+//fname can be "-" to read all of stdin. The f*LoadMapped loaders decode from one of these.
+dcaError dcaMapFile(dcaMappedFile *mf, const char *fname);
+void dcaUnmapFile(dcaMappedFile *mf);
+//Writes a complete output file, replacing fname in one step so it's never seen half written. fname can be "-" for stdout.
+dcaError dcaWriteFile(const char *fname, const void *data, size_t size);
+
+//Stream properties read from a file's headers, without decoding any audio. Used by --info.
+typedef struct {
+	//Short name of the file type, such as "FLAC"
+	const char *type;
+	unsigned channel_cnt;
+	unsigned sample_rate_hz;
+	//Length in samples per channel, 0 if unknown
+	uint64_t samples_len;
+	//Set if samples_len was estimated from the bitrate instead of read from the file
+	bool len_estimated;
+	//Bits per sample for uncompressed and FLAC files, 0 for lossy formats
+	unsigned bits_per_sample;
+	//Bitrate of the first frame for MP3, nominal bitrate for Vorbis, 0 otherwise
+	unsigned bitrate_kbps;
+	
+	//Only set for .DCA files
+	dcaFormat format;
+	bool looping;
+	unsigned loop_start, loop_end;
+} dcaFileInfo;
+
+dcaError fDcaLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf);
+dcaError fDcaInfo(dcaFileInfo *info, const char *fname);
+//Encodes and writes a .DCA file. If preview_fname isn't NULL, a .WAV preview is made from the encoded
+//data in memory while the file is written, and the result of that goes in preview_error.
+dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname, const char *preview_fname, dcaError *preview_error);
+//Encodes the complete file into a new buffer, which the caller frees
+dcaError fDcaEncode(DcAudioConverter *cs, uint8_t **image, size_t *size);
+
+//Decodes all total_length samples of one channel of an encoded .DCA file to 16-bit PCM
+dcaError fDcaDecodeChannel(const fDcAudioHeader *dca, unsigned channel, int16_t *dst);
+
+/*
+	Decodes every channel of an encoded .DCA file to 16-bit PCM a piece at
+	a time, in order, so there's never a whole decoded copy of the sound.
+*/
+typedef struct {
+	const fDcAudioHeader *dca;
+	//Next sample to decode
+	size_t pos;
+	int adpcm_signal[DCA_FILE_MAX_CHANNELS];
+	int adpcm_step[DCA_FILE_MAX_CHANNELS];
+} fDcaDecoder;
+void fDcaDecoderInit(fDcaDecoder *dec, const fDcAudioHeader *dca);
+//Decodes up to frame_cnt samples of each channel into dst[channel], and returns how many were decoded.
+//frame_cnt must be even, unless it reaches the end of the sound.
+size_t fDcaDecode(fDcaDecoder *dec, int16_t **dst, size_t frame_cnt);
+
+//A sound to put in a bank or C source: its name, and the .DCA file made for it by fDcaEncode
+typedef struct {
+	const char *name;
+	uint8_t *image;
+	size_t size;
+} dcaBankSound;
+
+//Packs already encoded sounds into a bank (see fDcAudioBank in file_dca.h) and writes it. Identical
+//channels are stored once, and if share_prefixes is set, so are channels that start another channel.
+dcaError fBankWrite(const dcaBankSound *sounds, unsigned sound_cnt, bool share_prefixes, const char *outfname);
+//Writes encoded sounds as 32 byte aligned C arrays in outfname, declared in a header next to it
+dcaError fCSourceWrite(const dcaBankSound *sounds, unsigned sound_cnt, const char *outfname);
 unsigned fDcaConvertFrequency(unsigned int freq_hz);
 float fDcaUnconvertFrequency(unsigned int freq);
 //Converts a given freqency to AICA closest match
 unsigned fDcaToAICAFrequency(unsigned int freq_hz);
 
-dcaError fWavLoad(DcAudioConverter *dcac, const char *fname);
+dcaError fWavLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf);
+dcaError fWavInfo(dcaFileInfo *info, const char *fname);
 dcaError fWavWrite(DcAudioConverter *dcac, const char *outfname);
+//Writes the decoded samples of an encoded .DCA file as a .WAV
+dcaError fWavWriteDca(const fDcAudioHeader *dca, dcaWavFormat wav_format, const char *outfname);
 
-dcaError fVorbisLoad(DcAudioConverter *dcac, const char *fname);
+dcaError fVorbisLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf);
+dcaError fVorbisInfo(dcaFileInfo *info, const char *fname);
 
-dcaError fFlacLoad(DcAudioConverter *dcac, const char *fname);
+dcaError fFlacLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf);
+dcaError fFlacInfo(dcaFileInfo *info, const char *fname);
 
-dcaError fMp3Load(DcAudioConverter *dcac, const char *fname);
+dcaError fMp3LoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf);
+dcaError fMp3Info(dcaFileInfo *info, const char *fname);
 
 void dcaDeinterleaveSamples(DcAudioConverter *dcac, int16_t *samples, unsigned sample_cnt, unsigned channels);
+/*
+	Incremental loading. dcaInitSamples allocates room for capacity samples
+	per channel (use the length of the input if known, or 0 for a default),
+	dcaAppendInterleaved deinterleaves a decoded block onto the end, growing
+	the buffers if needed, and dcaFinishSamples releases unused capacity.
+*/
+dcaError dcaInitSamples(DcAudioConverter *dcac, unsigned channels, size_t capacity);
+dcaError dcaAppendInterleaved(DcAudioConverter *dcac, const int16_t *samples, size_t frames);
+void dcaFinishSamples(DcAudioConverter *dcac);
+/*
+	Loaders only decode the part of the source selected with --range.
+	dcaGetRange converts it to samples at the source's rate. end is
+	UINT64_MAX if the range runs to the end of the source. Loaders that
+	have to decode from before the start use dcaAppendInterleavedRange,
+	giving the source position of the block, to keep only what's inside.
+*/
+void dcaGetRange(const DcAudioConverter *dcac, unsigned rate_hz, uint64_t *start, uint64_t *end);
+dcaError dcaAppendInterleavedRange(DcAudioConverter *dcac, const int16_t *samples, size_t frames, uint64_t pos, uint64_t start, uint64_t end);
 void dcaDownmixMono(DcAudioConverter *dcac);
+//Frees a channel's samples, or just drops them if they're borrowed from the source file
+void dcaFreeChannel(DcAudioConverter *dcac, unsigned channel);
+
+//Resamples all channels to new_rate_hz and scales loop points to match
+dcaError dcaResample(DcAudioConverter *dcac, unsigned new_rate_hz);
+//Resamples a looping sound so the loop is a whole number of samples, and joins cleanly when it wraps around.
+//The rate ends up within half a sample per loop of new_rate_hz, and anything after the loop is dropped.
+dcaError dcaResampleLoop(DcAudioConverter *dcac, unsigned new_rate_hz);
+//Resamples with dcaResampleLoop if loop_exact is set and the sound has a loop, and with dcaResample otherwise.
+//If aica_rate is set, a rate nudged to fit the loop is rounded again to one the AICA can play.
+dcaError dcaResampleSound(DcAudioConverter *dcac, unsigned new_rate_hz, bool loop_exact, bool aica_rate);
 
 const char * dcaErrorString(dcaError error);
 
+//Points in each FFT frame used by dcaAnalyzeSpectrum
+#define DCA_SPECTRUM_SIZE	2048
+
+//Power spectrum of a sound, summed over all frames and channels
+typedef struct {
+	unsigned sample_rate_hz;
+	//DCA_SPECTRUM_SIZE/2+1 bins, from 0 hz to the Nyquist frequency
+	unsigned bin_cnt;
+	double *power;
+	double total;
+} dcaSpectrum;
+
+dcaError dcaAnalyzeSpectrum(const DcAudioConverter *dcac, dcaSpectrum *spec);
+//Returns the fraction of the sound's energy above hz
+double dcaSpectrumFractionAbove(const dcaSpectrum *spec, double hz);
+//Returns the lowest frequency with no more than max_fraction of the sound's energy above it
+double dcaSpectrumBandwidth(const dcaSpectrum *spec, double max_fraction);
+void dcaSpectrumFree(dcaSpectrum *spec);
+
+//Loop start chosen by dcaFindLoop, and how well it joins
+typedef struct {
+	//False if there was no room for a loop of the minimum length, or the loop end is silent
+	bool found;
+	unsigned loop_start;
+	//How well the audio before the start matches the audio before the end, 1 if they're identical
+	double match;
+	//RMS difference between the spectra after the start and before the end
+	double spectral_db;
+	//How far the join is off in time after resampling, in output samples
+	double snap_error;
+} dcaLoopSearch;
+
+//Finds the start of a loop at least min_len samples long that joins most cleanly onto loop_end, for
+//--auto-loop. It's snapped to keep the join clean once the sound is resampled to out_rate_hz.
+dcaError dcaFindLoop(const DcAudioConverter *dcac, unsigned loop_end, unsigned min_len, unsigned out_rate_hz, dcaLoopSearch *result);
+
+//Most choices dcaPlanTrials can make for one sound
+#define DCA_PLAN_MAX_CHOICES	32
+//SNR given to lossless choices, and the most any choice can have. Choices never go below minus this.
+#define DCA_PLAN_MAX_SNR_DB	120.0f
+
+//One way of encoding a sound for --budget or --format auto-best, and how it turned out
+typedef struct {
+	dcaFormat format;
+	unsigned sample_rate_hz;
+	//Bytes of sample data, which is what takes up sound RAM
+	size_t size;
+	//Estimated signal to noise ratio compared to the original, in dB
+	float snr_db;
+	//Largest difference between a sample and its encoded version, at this choice's rate
+	unsigned peak_error;
+} dcaPlanChoice;
+
+typedef struct {
+	//Weight of this sound's quality compared to the others
+	double priority;
+	unsigned choice_cnt;
+	dcaPlanChoice choices[DCA_PLAN_MAX_CHOICES];
+	//Index of the choice picked by dcaPlanSolve
+	unsigned chosen;
+} dcaPlanSound;
+
+//Trial encodes ref in every format at its own sample rate, and at a range of lower ones if lower_rates
+//is set, and fills in plan's choices. Lower rates are made with dcaResampleSound, passing on loop_exact.
+dcaError dcaPlanTrials(const DcAudioConverter *ref, bool lower_rates, bool loop_exact, dcaPlanSound *plan);
+//Picks a choice for each sound, maximizing the sum of priority * SNR while fitting in budget bytes. Returns false if they can't fit.
+bool dcaPlanSolve(dcaPlanSound *sounds, unsigned sound_cnt, size_t budget);
+
+//64-bit FNV-1a, continuing from hash. Start with DCA_HASH64_INIT.
+#define DCA_HASH64_INIT	0xcbf29ce484222325ull
+uint64_t dcaHash64(const void *data, size_t size, uint64_t hash);
+
+//Trial results kept between runs, see --plan-cache
+typedef struct {
+	struct {
+		uint64_t key;
+		dcaPlanChoice choice;
+	} *entries;
+	size_t entry_cnt, capacity;
+} dcaPlanCache;
+
+//Starts with an empty cache if the file can't be read
+void dcaPlanCacheLoad(dcaPlanCache *cache, const char *fname);
+//Fills in plan's choices from the cache. Returns false if there are none for key.
+bool dcaPlanCacheGet(const dcaPlanCache *cache, uint64_t key, dcaPlanSound *plan);
+void dcaPlanCachePut(dcaPlanCache *cache, uint64_t key, const dcaPlanChoice *choices, unsigned choice_cnt);
+dcaError dcaPlanCacheSave(const dcaPlanCache *cache, const char *fname);
+void dcaPlanCacheFree(dcaPlanCache *cache);
+
 #endif
\ No newline at end of file
@@ -9,24 +9,52 @@ _dcaconv_completions()
 	_init_completion || return
 	
 	case $prev in
-		--help|--version|--long|--loop|--trim-loop-end|--verbose|--rate|--channels|--loop-start|--loop-end|--stereo|\
-		-!(-*)[hvLlEVrcseS])
+		--help|--version|--long|--loop|--trim-loop-end|--verbose|--rate|--channels|--loop-start|--loop-end|--stereo|--range|--budget|--rate-threshold|--quality|\
+		-!(-*)[hvLlEVrcseSx])
 			return
 			;;
 		-i|--in)
 			_filedir "@(wav|ogg|flac|mp3|dca)"
 			return
 			;;
+		-I|--info)
+			_filedir "@(wav|ogg|flac|mp3|dca)"
+			return
+			;;
 		-o|--out)
-			_filedir "@(dca|wav)"
+			_filedir "@(dca|wav|dcb|c)"
+			return
+			;;
+		--plan-cache)
+			_filedir
 			return
 			;;
 		-p|--preview)
 			_filedir "@(wav)"
 			return
 			;;
+		--in-format)
+			COMPREPLY=($(compgen -W "wav dca ogg flac mp3" "$cur"))
+			return
+			;;
+		--out-format)
+			COMPREPLY=($(compgen -W "wav dca bank c" "$cur"))
+			return
+			;;
 		-f|--format)
-			COMPREPLY=($(compgen -W "adpcm pcm8 pcm16" "$cur"))
+			COMPREPLY=($(compgen -W "adpcm pcm8 pcm16 auto-best" "$cur"))
+			return
+			;;
+		-R|--resampler)
+			COMPREPLY=($(compgen -W "auto sinc fft" "$cur"))
+			return
+			;;
+		--wav-format)
+			COMPREPLY=($(compgen -W "pcm16 pcm24 float" "$cur"))
+			return
+			;;
+		-C|--cpu)
+			COMPREPLY=($(compgen -W "auto scalar sse2 sse4.1 avx2 avx512" "$cur"))
 			return
 			;;
 		-t|--trim)
@@ -36,7 +64,7 @@ _dcaconv_completions()
 		*)
 			
 			#This is the suggestion if not suggesting for one of the above. It suggests supported options.
-			COMPREPLY=($(compgen -W "--in --out --preview --format --rate --channels --stereo --loop --loop-start --loop-end --trim --long --trim-loop-end --verbose --version" -- "$cur"))
+			COMPREPLY=($(compgen -W "--in --in-format --info --out --out-format --preview --format --quality --quality-rates --rate --rate-threshold --resampler --wav-format --channels --stereo --loop --loop-start --loop-end --auto-loop --loop-resample --range --trim --long --budget --plan-cache --share-prefixes --interleave --trim-loop-end --verbose --cpu --jobs --version" -- "$cur"))
 			return
 			;;
 		
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "fft.h"
+#include "cpu.h"
+
+unsigned dcaFftSizeFor(unsigned n) {
+	unsigned size = 1;
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+bool dcaFftInit(dcaFft *fft, unsigned size) {
+	assert(fft);
+	memset(fft, 0, sizeof(*fft));
+
+	if (size < 2 || (size & (size-1)) != 0)
+		return false;
+
+	fft->size = size;
+	fft->bitrev = malloc(size * sizeof(unsigned));
+	fft->twiddle = malloc((size - 1) * sizeof(dcaComplex));
+	if (fft->bitrev == NULL || fft->twiddle == NULL) {
+		dcaFftFree(fft);
+		return false;
+	}
+
+	unsigned bits = 0;
+	while ((1u << bits) < size)
+		bits++;
+	for(unsigned i = 0; i < size; i++) {
+		unsigned r = 0;
+		for(unsigned b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		fft->bitrev[i] = r;
+	}
+
+	//Calculate twiddles in double so large transforms don't accumulate error.
+	//Each pass gets its own copy so the transform reads them contiguously.
+	dcaComplex *tw = fft->twiddle;
+	for(unsigned len = 2; len <= size; len <<= 1) {
+		for(unsigned i = 0; i < len / 2; i++) {
+			double angle = -2.0 * M_PI * i / len;
+			tw[i].re = cos(angle);
+			tw[i].im = sin(angle);
+		}
+		tw += len / 2;
+	}
+
+	return true;
+}
+
+void dcaFftFree(dcaFft *fft) {
+	assert(fft);
+	free(fft->bitrev);
+	free(fft->twiddle);
+	memset(fft, 0, sizeof(*fft));
+}
+
+void dcaFftForward(const dcaFft *fft, dcaComplex *data) {
+	dcaCpu.fft_transform(fft, data, 1.0f);
+}
+
+void dcaFftInverse(const dcaFft *fft, dcaComplex *data) {
+	dcaCpu.fft_transform(fft, data, -1.0f);
+}
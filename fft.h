@@ -0,0 +1,38 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdbool.h>
+
+/*
+	Small dependency free radix-2 complex FFT.
+
+	Transforms are done in place. The inverse transform is not scaled, so
+	a forward transform followed by an inverse transform multiplies the
+	data by the FFT size.
+*/
+
+typedef struct {
+	float re, im;
+} dcaComplex;
+
+typedef struct {
+	//Number of points, always a power of two
+	unsigned size;
+	unsigned *bitrev;
+	//Twiddle factors for the forward transform, size/2 for the last pass,
+	//preceded by the ones for each earlier pass (size-1 in total)
+	dcaComplex *twiddle;
+} dcaFft;
+
+//Returns the smallest power of two that is greater than or equal to n
+unsigned dcaFftSizeFor(unsigned n);
+
+//Prepares tables for transforms of the given size. size must be a power of two.
+//Returns false on failure.
+bool dcaFftInit(dcaFft *fft, unsigned size);
+void dcaFftFree(dcaFft *fft);
+
+void dcaFftForward(const dcaFft *fft, dcaComplex *data);
+void dcaFftInverse(const dcaFft *fft, dcaComplex *data);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dca_conv.h"
+
+/*
+	Builds a sound bank (see fDcAudioBank in file_dca.h) out of sounds
+	that have already been encoded with fDcaEncode. The bank is built in
+	one buffer, then written with dcaWriteFile.
+
+	Channels with the same sample data are only stored once, with each of
+	their entries pointing at the same offset. If share_prefixes is set, a
+	channel whose data is the start of a longer channel points into that
+	one instead. A sound only plays its own length, so what follows in the
+	longer channel is never heard.
+
+	To find matches without comparing every pair of channels byte by byte,
+	each channel's data is hashed in 32 byte blocks, keeping the hash of
+	the first n blocks for every n. Two channels can only match if the
+	hash of the shorter one's whole blocks matches the same number of
+	blocks of the other, and only those are compared in full.
+*/
+
+//Hash table slots are a uint16_t, and the table is kept at most half full
+#define BANK_MAX_SOUNDS	(1<<14)
+
+static size_t AlignUp(size_t size) {
+	return (size + DCA_ALIGNMENT_MASK) & ~(size_t)DCA_ALIGNMENT_MASK;
+}
+
+typedef struct {
+	const uint8_t *data;
+	//Bytes holding samples, and with padding
+	size_t used;
+	size_t size;
+	//prefix_hash[n] is the hash of the first n blocks of data
+	uint64_t *prefix_hash;
+	//Channel whose data this one uses (itself if it's stored), and where it is in the bank
+	size_t owner;
+	size_t offset;
+} BankChannel;
+
+//Bytes of a channel that are played, before it's padded to 32 bytes
+static size_t UsedBytes(const fDcAudioHeader *dca) {
+	size_t len = fDaGetTotalLength(dca);
+	switch (fDaGetSampleFormat(dca)) {
+	case DCA_FLAG_FORMAT_PCM16:
+		return len * 2;
+	case DCA_FLAG_FORMAT_ADPCM:
+		return (len + 1) / 2;
+	default:
+		return len;
+	}
+}
+
+static bool HashChannel(BankChannel *ch) {
+	size_t blocks = ch->used / DCA_ALIGNMENT;
+	ch->prefix_hash = malloc((blocks + 1) * sizeof(uint64_t));
+	if (ch->prefix_hash == NULL)
+		return false;
+	ch->prefix_hash[0] = DCA_HASH64_INIT;
+	for(size_t i = 0; i < blocks; i++)
+		ch->prefix_hash[i + 1] = dcaHash64(ch->data + i * DCA_ALIGNMENT, DCA_ALIGNMENT, ch->prefix_hash[i]);
+	return true;
+}
+
+//Whether short's data is the same as long's, or the start of it
+static bool IsPrefixOf(const BankChannel *short_ch, const BankChannel *long_ch) {
+	size_t blocks = short_ch->used / DCA_ALIGNMENT;
+	return short_ch->used <= long_ch->used
+		&& short_ch->prefix_hash[blocks] == long_ch->prefix_hash[blocks]
+		&& memcmp(short_ch->data, long_ch->data, short_ch->used) == 0;
+}
+
+//Longest channels first, so any channel that can be shared is placed before the ones using it.
+//Equal lengths keep their order, so the first of identical channels is the one stored.
+static int CompareChannels(const void *a, const void *b) {
+	const BankChannel *ca = *(BankChannel * const*)a, *cb = *(BankChannel * const*)b;
+	if (ca->used != cb->used)
+		return ca->used > cb->used ? -1 : 1;
+	return ca < cb ? -1 : ca > cb;
+}
+
+//Points each channel at the first stored channel it can use, and returns the number of bytes to store
+static size_t ShareChannels(BankChannel *channels, size_t channel_cnt, BankChannel **order, bool share_prefixes) {
+	for(size_t i = 0; i < channel_cnt; i++)
+		order[i] = &channels[i];
+	qsort(order, channel_cnt, sizeof(order[0]), CompareChannels);
+	
+	//The start of order is reused to list the stored channels
+	size_t stored_cnt = 0;
+	for(size_t i = 0; i < channel_cnt; i++) {
+		BankChannel *ch = order[i];
+		ch->owner = ch - channels;
+		for(size_t j = 0; j < stored_cnt; j++) {
+			const BankChannel *other = order[j];
+			if ((share_prefixes || other->used == ch->used) && IsPrefixOf(ch, other)) {
+				ch->owner = other - channels;
+				break;
+			}
+		}
+		if (ch->owner == (size_t)(ch - channels))
+			order[stored_cnt++] = ch;
+	}
+	
+	//Stored channels keep the order of the sounds they came from
+	size_t data_size = 0;
+	for(size_t i = 0; i < channel_cnt; i++) {
+		if (channels[i].owner == i) {
+			channels[i].offset = data_size;
+			data_size += channels[i].size;
+		}
+	}
+	return data_size;
+}
+
+dcaError fBankWrite(const dcaBankSound *sounds, unsigned sound_cnt, bool share_prefixes, const char *outfname) {
+	assert(sounds);
+	assert(outfname);
+	
+	if (sound_cnt == 0 || sound_cnt > BANK_MAX_SOUNDS)
+		return DCAE_TOO_MANY_SOUNDS;
+	
+	//Smallest power of two that keeps the table at most half full
+	unsigned slot_cnt = 2;
+	while (slot_cnt < sound_cnt * 2)
+		slot_cnt *= 2;
+	
+	size_t channel_cnt = 0;
+	for(unsigned i = 0; i < sound_cnt; i++) {
+		const fDcAudioHeader *dca = (const fDcAudioHeader*)sounds[i].image;
+		assert(sounds[i].size == fDaGetFileSize(dca));
+		if (fDaIsInterleaved(dca))
+			return DCAE_UNSUPPORTED_FILE_TYPE;
+		channel_cnt += fDaGetChannelCount(dca);
+	}
+	
+	dcaError retval = DCAE_OUT_OF_MEMORY;
+	uint8_t *bank = NULL;
+	BankChannel *channels = calloc(channel_cnt, sizeof(BankChannel));
+	BankChannel **order = malloc(channel_cnt * sizeof(BankChannel*));
+	if (channels == NULL || order == NULL)
+		goto cleanup;
+	
+	//Find which channels can share data
+	size_t next_channel = 0, unshared_size = 0;
+	for(unsigned i = 0; i < sound_cnt; i++) {
+		fDcAudioHeader *dca = (fDcAudioHeader*)sounds[i].image;
+		for(unsigned c = 0; c < fDaGetChannelCount(dca); c++) {
+			BankChannel *ch = &channels[next_channel++];
+			ch->data = fDaGetChannelSamples(dca, c);
+			ch->used = UsedBytes(dca);
+			ch->size = fDaCalcChannelSizeBytes(dca);
+			if (!HashChannel(ch))
+				goto cleanup;
+			unshared_size += ch->size;
+		}
+	}
+	size_t data_size = ShareChannels(channels, channel_cnt, order, share_prefixes);
+	
+	fDcAudioBank head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.fourcc, DCA_BANK_FOURCC_STR, sizeof(head.fourcc));
+	head.version = 0;
+	head.entry_cnt = sound_cnt;
+	head.slot_cnt = slot_cnt;
+	head.entries_offset = AlignUp(sizeof(head) + slot_cnt * sizeof(uint16_t));
+	head.channels_offset = AlignUp(head.entries_offset + sound_cnt * sizeof(fDcAudioBankEntry));
+	head.data_offset = AlignUp(head.channels_offset + channel_cnt * sizeof(uint32_t));
+	
+	size_t bank_size = head.data_offset + data_size;
+	if (bank_size > UINT32_MAX) {
+		retval = DCAE_TOO_LONG;
+		goto cleanup;
+	}
+	head.chunk_size = bank_size;
+	
+	bank = calloc(1, bank_size);
+	if (bank == NULL)
+		goto cleanup;
+	memcpy(bank, &head, sizeof(head));
+	fDcAudioBank *bankp = (fDcAudioBank*)bank;
+	uint16_t *slots = (uint16_t*)(bank + sizeof(head));
+	uint32_t *channel_offsets = (uint32_t*)(bank + head.channels_offset);
+	memset(slots, 0xff, slot_cnt * sizeof(uint16_t));
+	
+	for(size_t i = 0; i < channel_cnt; i++) {
+		const BankChannel *ch = &channels[i];
+		if (ch->owner == i)
+			memcpy(bank + head.data_offset + ch->offset, ch->data, ch->size);
+		channel_offsets[i] = head.data_offset + channels[ch->owner].offset;
+	}
+	
+	retval = DCAE_OK;
+	next_channel = 0;
+	for(unsigned i = 0; i < sound_cnt; i++) {
+		fDcAudioHeader *dca = (fDcAudioHeader*)sounds[i].image;
+		uint32_t hash = fDaHashName(sounds[i].name);
+		if (fDaBankFindHash(bankp, hash) != NULL) {
+			dcaLog(LOG_WARNING, "Sound '%s' has the same name or name hash as an earlier sound\n", sounds[i].name);
+			retval = DCAE_DUPLICATE_NAME;
+			goto cleanup;
+		}
+		
+		fDcAudioBankEntry *entry = fDaBankGetEntry(bankp, i);
+		entry->name_hash = hash;
+		entry->flags = dca->flags;
+		entry->sample_rate_aica = dca->sample_rate_aica;
+		entry->total_length = dca->total_length;
+		entry->loop_start = dca->loop_start;
+		entry->loop_end = dca->loop_end;
+		entry->channel_size = fDaCalcChannelSizeBytes(dca);
+		entry->first_channel = next_channel;
+		
+		unsigned slot = hash & (slot_cnt - 1);
+		while (slots[slot] != DCA_BANK_EMPTY_SLOT)
+			slot = (slot + 1) & (slot_cnt - 1);
+		slots[slot] = i;
+		
+		dcaLog(LOG_INFO, "Bank sound %u: '%s' (hash %08x), %u channel%s of %u bytes\n", i, sounds[i].name, hash,
+			fDaGetChannelCount(dca), fDaGetChannelCount(dca) > 1 ? "s" : "", entry->channel_size);
+		for(unsigned c = 0; c < fDaGetChannelCount(dca); c++, next_channel++) {
+			size_t owner = channels[next_channel].owner;
+			if (owner != next_channel)
+				dcaLog(LOG_INFO, "  Channel %u shares data with bank channel %zu%s\n", c, owner,
+					channels[next_channel].used < channels[owner].used ? " (prefix)" : "");
+		}
+	}
+	assert(fDaBankValidate(bankp, bank_size));
+	
+	retval = dcaWriteFile(outfname, bank, bank_size);
+	if (retval == DCAE_OK) {
+		dcaLog(LOG_PROGRESS, "Wrote bank of %u sound%s, %zu bytes of sample data (%zu bytes in total)\n",
+			sound_cnt, sound_cnt > 1 ? "s" : "", data_size, bank_size);
+		if (data_size < unshared_size)
+			dcaLog(LOG_PROGRESS, "Sharing identical sample data saved %zu bytes of sound RAM\n", unshared_size - data_size);
+	}
+	
+cleanup:
+	for(size_t i = 0; channels && i < channel_cnt; i++)
+		free(channels[i].prefix_hash);
+	free(channels);
+	free(order);
+	free(bank);
+	return retval;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "dca_conv.h"
+
+/*
+	Writes already encoded sounds as C source, so they can be linked into
+	a program instead of being loaded from disc. Each sound becomes a
+	const array holding its complete .DCA file, aligned to 32 bytes so it
+	can be DMA'd to sound RAM straight from where it's linked, and used
+	with the functions in file_dca.h by casting it to fDcAudioHeader.
+
+	outfname gets the arrays, and a header with the same name ending in .h
+	gets extern declarations for them. Arrays are named after their sounds,
+	with anything that can't be in a C identifier replaced by '_'.
+*/
+
+//Characters of one array element: "0xff," plus a space or newline
+#define BYTE_TEXT_LEN	6
+#define BYTES_PER_LINE	16
+
+//Makes a C identifier out of name, which the caller frees
+static char * SymbolName(const char *name) {
+	size_t len = strlen(name);
+	char *sym = malloc(len + 2);
+	if (sym == NULL)
+		return NULL;
+	
+	char *d = sym;
+	if (len == 0 || isdigit((unsigned char)name[0]))
+		*d++ = '_';
+	for(size_t i = 0; i < len; i++)
+		*d++ = isalnum((unsigned char)name[i]) ? name[i] : '_';
+	*d = 0;
+	return sym;
+}
+
+//Name of the header that goes with outfname
+static char * HeaderName(const char *outfname) {
+	const char *base = strrchr(outfname, '/');
+	base = base ? base + 1 : outfname;
+	const char *dot = strrchr(base, '.');
+	size_t stem = dot ? (size_t)(dot - outfname) : strlen(outfname);
+	
+	char *name = malloc(stem + 3);
+	if (name == NULL)
+		return NULL;
+	memcpy(name, outfname, stem);
+	strcpy(name + stem, ".h");
+	return name;
+}
+
+//Appends the bytes of data as array elements
+static size_t FormatBytes(char *dst, const uint8_t *data, size_t size) {
+	static const char hex[] = "0123456789abcdef";
+	char *d = dst;
+	for(size_t i = 0; i < size; i++) {
+		if (i % BYTES_PER_LINE == 0)
+			*d++ = '\t';
+		*d++ = '0';
+		*d++ = 'x';
+		*d++ = hex[data[i] >> 4];
+		*d++ = hex[data[i] & 15];
+		*d++ = ',';
+		*d++ = (i % BYTES_PER_LINE == BYTES_PER_LINE - 1 || i == size - 1) ? '\n' : ' ';
+	}
+	return d - dst;
+}
+
+dcaError fCSourceWrite(const dcaBankSound *sounds, unsigned sound_cnt, const char *outfname) {
+	assert(sounds);
+	assert(outfname);
+	
+	if (strcmp(outfname, "-") == 0) {
+		dcaLog(LOG_WARNING, "C source can't be written to stdout, since it comes with a header\n");
+		return DCAE_UNSUPPORTED_FILE_TYPE;
+	}
+	
+	dcaError retval = DCAE_OUT_OF_MEMORY;
+	char *source = NULL, *header = NULL, *header_fname = HeaderName(outfname);
+	char **symbols = calloc(sound_cnt, sizeof(char*));
+	if (header_fname == NULL || symbols == NULL)
+		goto cleanup;
+	if (strcmp(header_fname, outfname) == 0) {
+		dcaLog(LOG_WARNING, "C source output can't end with .h, since that's the name of its header\n");
+		retval = DCAE_UNSUPPORTED_FILE_TYPE;
+		goto cleanup;
+	}
+	
+	const char *header_base = strrchr(header_fname, '/');
+	header_base = header_base ? header_base + 1 : header_fname;
+	
+	//Every line other than the sample data is well under this
+	const size_t line_max = 256;
+	size_t source_max = line_max * 4, header_max = line_max * 8;
+	for(unsigned i = 0; i < sound_cnt; i++) {
+		symbols[i] = SymbolName(sounds[i].name);
+		if (symbols[i] == NULL)
+			goto cleanup;
+		for(unsigned j = 0; j < i; j++) {
+			if (strcmp(symbols[i], symbols[j]) == 0) {
+				dcaLog(LOG_WARNING, "Sounds '%s' and '%s' would have the same C name\n", sounds[j].name, sounds[i].name);
+				retval = DCAE_DUPLICATE_NAME;
+				goto cleanup;
+			}
+		}
+		source_max += sounds[i].size * BYTE_TEXT_LEN + sounds[i].size / BYTES_PER_LINE + 2 * strlen(symbols[i]) + line_max;
+		header_max += strlen(symbols[i]) + line_max;
+	}
+	
+	source = malloc(source_max);
+	header = malloc(header_max + strlen(header_base) * 3);
+	if (source == NULL || header == NULL)
+		goto cleanup;
+	
+	//Include guard, from the header's name
+	char *guard = strdup(header_base);
+	if (guard == NULL)
+		goto cleanup;
+	for(char *c = guard; *c; c++)
+		*c = isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+	
+	size_t hlen = sprintf(header, "//Generated by dcaconv. Each array is a complete .DCA file, see file_dca.h.\n\n"
+		"#ifndef %s\n#define %s\n\n#include <stdint.h>\n\n", guard, guard);
+	size_t slen = sprintf(source, "//Generated by dcaconv\n\n#include \"%s\"\n", header_base);
+	for(unsigned i = 0; i < sound_cnt; i++) {
+		hlen += sprintf(header + hlen, "extern const uint8_t %s[%zu] __attribute__((aligned(%u)));\n",
+			symbols[i], sounds[i].size, DCA_ALIGNMENT);
+		slen += sprintf(source + slen, "\nconst uint8_t %s[%zu] __attribute__((aligned(%u))) = {\n",
+			symbols[i], sounds[i].size, DCA_ALIGNMENT);
+		slen += FormatBytes(source + slen, sounds[i].image, sounds[i].size);
+		slen += sprintf(source + slen, "};\n");
+		dcaLog(LOG_INFO, "Sound '%s' is %s, %zu bytes\n", sounds[i].name, symbols[i], sounds[i].size);
+	}
+	hlen += sprintf(header + hlen, "\n#endif\n");
+	free(guard);
+	assert(slen <= source_max);
+	
+	retval = dcaWriteFile(header_fname, header, hlen);
+	if (retval == DCAE_OK)
+		retval = dcaWriteFile(outfname, source, slen);
+	if (retval == DCAE_OK)
+		dcaLog(LOG_PROGRESS, "Wrote %u sound%s to '%s' and '%s'\n", sound_cnt, sound_cnt > 1 ? "s" : "", outfname, header_fname);
+	
+cleanup:
+	for(unsigned i = 0; symbols && i < sound_cnt; i++)
+		free(symbols[i]);
+	free(symbols);
+	free(source);
+	free(header);
+	free(header_fname);
+	return retval;
+}
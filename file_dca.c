@@ -7,6 +7,7 @@
 #include "file_dca.h"
 
 #include "dca_conv.h"
+#include "parallel.h"
 
 
 unsigned fDcaToAICAFrequency(unsigned int freq_hz) {
@@ -22,76 +23,215 @@ void ConvertTo8bit(const int16_t *src, int8_t *dst, size_t sample_cnt) {
 void pcm2adpcm(unsigned char *dst, const short *src, size_t length);
 void adpcm2pcm(short *dst, const unsigned char *src, size_t length);
 
-dcaError fDcaLoad(DcAudioConverter *dcac, const char *fname) {
+dcaError fDcaLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf) {
 	assert(dcac);
-	assert(fname);
-	
-	//Open
-	FILE *f = fopen(fname, "rb");
-	if (f == NULL)
-		return DCAE_READ_OPEN_ERROR;
-	
-	//Get size
-	fseek(f, 0, SEEK_END);
-	size_t filesize = ftell(f);
-	fseek(f, 0, SEEK_SET);
+	assert(mf);
 	
-	//Load
-	fDcAudioHeader *data = malloc(filesize);
-	size_t amountread = fread(data, 1, filesize, f);
-	fclose(f);
-	
-	if (amountread != filesize)
+	//Samples are converted straight out of the mapping, without loading a copy of the file
+	const fDcAudioHeader *data = mf->data;
+	if (mf->size < sizeof(fDcAudioHeader) || fDaGetFileSize(data) > mf->size)
 		goto readerror;
 	if (!fDaValidateHeader(data))
 		goto readerror;
 	
 	unsigned channels = fDaGetChannelCount(data);
-	unsigned sample_cnt = fDaGetTotalLength(data);
+	unsigned total_cnt = fDaGetTotalLength(data);
 	
 	dcac->sample_rate_hz = fDaCalcSampleRateHz(data);
+	
+	uint64_t start, end;
+	dcaGetRange(dcac, dcac->sample_rate_hz, &start, &end);
+	if (end > total_cnt)
+		end = total_cnt;
+	if (start > 0 && start >= end)
+		return DCAE_BAD_RANGE;
+	unsigned sample_cnt = end - start;
+	
 	dcac->channel_cnt = channels;
 	dcac->samples_len = sample_cnt;
 	
-	dcaLog(LOG_INFO, "DCA file loaded has %u channel%s with %u samples at %u hz\n", channels, channels>1?"s":"", sample_cnt, dcac->sample_rate_hz);
+	dcaLog(LOG_INFO, "DCA file loaded has %u channel%s with %u samples at %u hz\n", channels, channels>1?"s":"", total_cnt, dcac->sample_rate_hz);
+	
+	//Interleaved channels are gathered from their blocks into a contiguous copy first
+	bool interleaved = fDaIsInterleaved(data);
+	uint8_t *gathered = NULL;
+	if (interleaved) {
+		gathered = malloc(fDaCalcChannelSizeBytes(data));
+		if (gathered == NULL)
+			return DCAE_OUT_OF_MEMORY;
+	}
 	
 	//Convert to 16-bit PCM
 	unsigned format = fDaGetSampleFormat(data);
-	if (format == DCAF_PCM16) {
+	if (format == DCAF_PCM16 && !interleaved) {
+		//Already in the right format, so use the samples in place. The caller keeps the file mapped.
+		for(unsigned c = 0; c < channels; c++) {
+			int16_t *channel_ptr = fDaGetChannelSamples((fDcAudioHeader*)data, c);
+			dcac->samples[c] = channel_ptr + start;
+			dcac->borrowed_channels |= 1u << c;
+		}
+	} else if (format == DCAF_PCM16) {
 		for(unsigned c = 0; c < channels; c++) {
 			dcac->samples[c] = calloc(sample_cnt, sizeof(int16_t));
-			void *channel_ptr = fDaGetChannelSamples(data, c);
-			memcpy(dcac->samples[c], channel_ptr, sample_cnt * sizeof(int16_t));
+			fDaCopyChannelBytes(data, c, start * sizeof(int16_t), dcac->samples[c], sample_cnt * sizeof(int16_t));
 		}
 	} else if (format == DCAF_PCM8) {
 		for(unsigned c = 0; c < channels; c++) {
 			dcac->samples[c] = calloc(sample_cnt, sizeof(int16_t));
-			int8_t *channel_ptr = (int8_t*)fDaGetChannelSamples(data, c);;
+			const int8_t *channel_ptr = fDaGetChannelSamples((fDcAudioHeader*)data, c);
+			if (interleaved) {
+				fDaCopyChannelBytes(data, c, 0, gathered, end);
+				channel_ptr = (const int8_t*)gathered;
+			}
 			for(unsigned i = 0; i < sample_cnt; i++) {
-				dcac->samples[c][i] = channel_ptr[i] * 256;
+				dcac->samples[c][i] = channel_ptr[start + i] * 256;
 			}
 		}
 	} else if (format == DCAF_ADPCM) {
+		//ADPCM can only be decoded from the start, so decode up to the end and drop the samples before the range
 		for(unsigned c = 0; c < channels; c++) {
-			dcac->samples[c] = calloc(sample_cnt, sizeof(int16_t));
-			uint8_t *channel_ptr = (uint8_t*)fDaGetChannelSamples(data, c);;
-			adpcm2pcm(dcac->samples[c], channel_ptr, sample_cnt);
+			dcac->samples[c] = calloc(end, sizeof(int16_t));
+			const uint8_t *channel_ptr = fDaGetChannelSamples((fDcAudioHeader*)data, c);
+			if (interleaved) {
+				fDaCopyChannelBytes(data, c, 0, gathered, (end + 1) / 2);
+				channel_ptr = gathered;
+			}
+			adpcm2pcm(dcac->samples[c], channel_ptr, end);
+			if (start > 0)
+				memmove(dcac->samples[c], dcac->samples[c] + start, sample_cnt * sizeof(int16_t));
 		}
 	} else {
+		free(gathered);
 		goto readerror;
 	}
 	
-	free(data);
+	free(gathered);
 	return DCAE_OK;
 	
 readerror:
-	free(data);
 	return DCAE_READ_ERROR;
 }
 
-dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname) {
+dcaError fDcaInfo(dcaFileInfo *info, const char *fname) {
+	assert(info);
+	assert(fname);
+	
+	//Everything is in the 32 byte header
+	FILE *f = fopen(fname, "rb");
+	if (f == NULL)
+		return DCAE_READ_OPEN_ERROR;
+	fDcAudioHeader head;
+	size_t read = fread(&head, sizeof(head), 1, f);
+	fclose(f);
+	if (read != 1 || !fDaValidateHeader(&head))
+		return DCAE_READ_ERROR;
+	
+	info->type = "DCA";
+	info->channel_cnt = fDaGetChannelCount(&head);
+	info->sample_rate_hz = fDaCalcSampleRateHz(&head);
+	info->samples_len = fDaGetTotalLength(&head);
+	info->format = fDaGetSampleFormat(&head);
+	info->bits_per_sample = info->format == DCAF_PCM16 ? 16 : info->format == DCAF_PCM8 ? 8 : 4;
+	info->looping = fDaIsLooping(&head);
+	info->loop_start = fDaGetLoopStart(&head);
+	info->loop_end = fDaGetLoopEnd(&head);
+	
+	return DCAE_OK;
+}
+
+void adpcm2pcm_continue(short *dst, const unsigned char *src, size_t length, int *signal, int *step);
+
+//Points src at the encoded bytes of a channel from offset on, and returns how many of them are contiguous
+static size_t ChannelSpan(const fDcAudioHeader *dca, unsigned channel, size_t offset, const uint8_t **src) {
+	if (fDaIsInterleaved(dca)) {
+		*src = (const uint8_t*)fDaGetChannelBlock((fDcAudioHeader*)dca, channel, offset / dca->block_size) + offset % dca->block_size;
+		return dca->block_size - offset % dca->block_size;
+	}
+	*src = (const uint8_t*)fDaGetChannelSamples((fDcAudioHeader*)dca, channel) + offset;
+	return fDaCalcChannelSizeBytes(dca) - offset;
+}
+
+/*
+	Decodes cnt samples of a channel starting at sample pos, continuing
+	the ADPCM state in signal and step. Interleaved channels are decoded
+	straight from each block in turn. Blocks are a multiple of 32 bytes,
+	so ADPCM never splits a byte across them, but pos must be even.
+*/
+static void DecodeChannelPart(const fDcAudioHeader *dca, unsigned channel, size_t pos, size_t cnt, int16_t *dst, int *signal, int *step) {
+	unsigned format = fDaGetSampleFormat(dca);
+	assert(format != DCAF_ADPCM || pos % 2 == 0);
+	
+	while (cnt > 0) {
+		size_t offset = format == DCAF_PCM16 ? pos * 2 : format == DCAF_ADPCM ? pos / 2 : pos;
+		const uint8_t *src;
+		size_t span = ChannelSpan(dca, channel, offset, &src);
+		size_t n = format == DCAF_PCM16 ? span / 2 : format == DCAF_ADPCM ? span * 2 : span;
+		if (n > cnt)
+			n = cnt;
+		
+		if (format == DCAF_PCM16) {
+			memcpy(dst, src, n * sizeof(int16_t));
+		} else if (format == DCAF_PCM8) {
+			for(size_t i = 0; i < n; i++)
+				dst[i] = (int8_t)src[i] * 256;
+		} else if (format == DCAF_ADPCM) {
+			adpcm2pcm_continue(dst, src, n, signal, step);
+		}
+		
+		dst += n;
+		pos += n;
+		cnt -= n;
+	}
+}
+
+dcaError fDcaDecodeChannel(const fDcAudioHeader *dca, unsigned channel, int16_t *dst) {
+	assert(dca);
+	assert(dst);
+	assert(channel < fDaGetChannelCount(dca));
+	
+	int signal = 0, step = 0x7f;
+	DecodeChannelPart(dca, channel, 0, fDaGetTotalLength(dca), dst, &signal, &step);
+	return DCAE_OK;
+}
+
+void fDcaDecoderInit(fDcaDecoder *dec, const fDcAudioHeader *dca) {
+	assert(dec);
+	assert(dca);
+	dec->dca = dca;
+	dec->pos = 0;
+	for(unsigned c = 0; c < DCA_FILE_MAX_CHANNELS; c++) {
+		dec->adpcm_signal[c] = 0;
+		dec->adpcm_step[c] = 0x7f;
+	}
+}
+
+size_t fDcaDecode(fDcaDecoder *dec, int16_t **dst, size_t frame_cnt) {
+	assert(dec);
+	assert(dst);
+	
+	size_t left = fDaGetTotalLength(dec->dca) - dec->pos;
+	if (frame_cnt > left)
+		frame_cnt = left;
+	if (frame_cnt == 0)
+		return 0;
+	assert(frame_cnt == left || frame_cnt % 2 == 0);
+	
+	for(unsigned c = 0; c < fDaGetChannelCount(dec->dca); c++)
+		DecodeChannelPart(dec->dca, c, dec->pos, frame_cnt, dst[c], &dec->adpcm_signal[c], &dec->adpcm_step[c]);
+	dec->pos += frame_cnt;
+	return frame_cnt;
+}
+
+/*
+	The whole file is encoded into one buffer, with each channel converted
+	straight into its padded slot after the header, then written out in
+	one go. This avoids a second copy of every channel, and lets the
+	file be swapped into place in one step (see dcaWriteFile).
+*/
+dcaError fDcaEncode(DcAudioConverter *cs, uint8_t **image_out, size_t *size_out) {
 	assert(cs);
-	assert(outfname);
+	assert(image_out);
+	assert(size_out);
 	assert(cs->channel_cnt > 0);
 	for(unsigned i = 0; i < cs->channel_cnt; i++)
 		assert(cs->samples[i] != NULL);
@@ -119,29 +259,10 @@ dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname) {
 		assert(0 && "bad format");
 	}
 	
-	//Round channel size up to multiple of 32
-	channelsize = (channelsize+DCA_ALIGNMENT_MASK) & ~DCA_ALIGNMENT_MASK;
-	
-	//Convert to target format
-	void *samples[DCA_FILE_MAX_CHANNELS];
-	if (cs->format == DCAF_PCM16) {
-		//Already in target format, just copy them
-		for(unsigned i = 0; i < cs->channel_cnt; i++) {
-			samples[i] = calloc(1, channelsize);
-			memcpy(samples[i], cs->samples[i], cs->samples_len * 2);
-		}
-	} else if (cs->format == DCAF_PCM8) {
-		//TODO add dithering?
-		for(unsigned i = 0; i < cs->channel_cnt; i++) {
-			samples[i] = calloc(1, channelsize);
-			ConvertTo8bit(cs->samples[i], samples[i], cs->samples_len);
-		}
-	} else if (cs->format == DCAF_ADPCM) {
-		for(unsigned i = 0; i < cs->channel_cnt; i++) {
-			samples[i] = calloc(1, channelsize);
-			pcm2adpcm(samples[i], cs->samples[i], cs->samples_len);
-		}
-	}
+	//Round channel size up to multiple of 32, or of the block size if interleaving
+	unsigned align = cs->block_size ? cs->block_size : DCA_ALIGNMENT;
+	assert(align % DCA_ALIGNMENT == 0);
+	channelsize = (channelsize + align - 1) / align * align;
 	
 	//Initialize header
 	fDcAudioHeader head;
@@ -152,8 +273,12 @@ dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname) {
 	head.flags = 
 		((cs->format & DCA_FLAG_FORMAT_MASK) << DCA_FLAG_FORMAT_SHIFT) |
 		(cs->channel_cnt & DCA_FLAG_CHANNEL_COUNT_MASK);
+	if (cs->block_size) {
+		head.version = 1;
+		head.flags |= DCA_FLAG_INTERLEAVED;
+		head.block_size = cs->block_size;
+	}
 	head.sample_rate_aica = fDaConvertFrequency(cs->sample_rate_hz);
-	unsigned converted_sample_rate = fDcaToAICAFrequency(cs->sample_rate_hz);
 	head.total_length = cs->samples_len;
 	
 	if (cs->looping) {
@@ -166,25 +291,102 @@ dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname) {
 	
 	assert(fDaValidateHeader(&head));
 	
-	//Write to disk
-	unsigned written = 0;
-	FILE *f = fopen(outfname, "w");
-	if (f == NULL)
-		return DCAE_WRITE_OPEN_ERROR;
+	//Padding after each channel must be zero
+	uint8_t *image = calloc(1, head.chunk_size);
+	if (image == NULL)
+		return DCAE_OUT_OF_MEMORY;
+	memcpy(image, &head, sizeof(head));
 	
-	written += fwrite(&head, 1, sizeof(head), f);
-	for(unsigned i = 0; i < cs->channel_cnt; i++)
-		written += fwrite(samples[i], 1, channelsize, f);
-	fclose(f);
+	//Interleaved channels are converted into a scratch buffer, then split into their blocks
+	uint8_t *scratch = NULL;
+	if (cs->block_size) {
+		scratch = calloc(1, channelsize);
+		if (scratch == NULL) {
+			free(image);
+			return DCAE_OUT_OF_MEMORY;
+		}
+	}
 	
-	dcaLog(LOG_PROGRESS, "Wrote %u channel%s of %u samples at %u hz, in %s format\n",
-		cs->channel_cnt, cs->channel_cnt>1?"s":"", head.total_length, converted_sample_rate, fDaFormatString(cs->format));
+	//Convert to target format
+	for(unsigned i = 0; i < cs->channel_cnt; i++) {
+		void *dst = scratch ? scratch : image + sizeof(head) + (size_t)channelsize * i;
+		if (cs->format == DCAF_PCM16) {
+			//Already in target format, just copy them
+			memcpy(dst, cs->samples[i], cs->samples_len * 2);
+		} else if (cs->format == DCAF_PCM8) {
+			//TODO add dithering?
+			ConvertTo8bit(cs->samples[i], dst, cs->samples_len);
+		} else if (cs->format == DCAF_ADPCM) {
+			pcm2adpcm(dst, cs->samples[i], cs->samples_len);
+		}
+		
+		if (scratch) {
+			for(size_t b = 0; b < channelsize / cs->block_size; b++)
+				memcpy(fDaGetChannelBlock((fDcAudioHeader*)image, i, b), scratch + b * cs->block_size, cs->block_size);
+		}
+	}
+	free(scratch);
+	
+	*image_out = image;
+	*size_out = head.chunk_size;
+	return DCAE_OK;
+}
+
+/*
+	The preview is decoded from the encoded image while it's being
+	written, instead of loading the written file back. Writing the file
+	and the preview are separate jobs, so they overlap when there's more
+	than one thread.
+*/
+typedef struct {
+	const uint8_t *image;
+	size_t size;
+	const char *outfname;
+	const char *preview_fname;
+	dcaWavFormat wav_format;
+	dcaError write_error;
+	dcaError preview_error;
+} WriteJobs;
+
+static void WriteJob(void *ctx, unsigned job) {
+	WriteJobs *jobs = ctx;
+	if (job == 0)
+		jobs->write_error = dcaWriteFile(jobs->outfname, jobs->image, jobs->size);
+	else
+		jobs->preview_error = fWavWriteDca((const fDcAudioHeader*)jobs->image, jobs->wav_format, jobs->preview_fname);
+}
+
+dcaError fDcaWrite(DcAudioConverter *cs, const char *outfname, const char *preview_fname, dcaError *preview_error) {
+	assert(cs);
+	assert(outfname);
+	assert(preview_fname == NULL || preview_error);
 	
+	uint8_t *image;
+	size_t size;
+	dcaError err = fDcaEncode(cs, &image, &size);
+	if (err != DCAE_OK) {
+		if (preview_error)
+			*preview_error = err;
+		return err;
+	}
 	
-	for(unsigned i = 0; i < cs->channel_cnt; i++)
-		free(samples[i]);
+	WriteJobs jobs = {
+		.image = image,
+		.size = size,
+		.outfname = outfname,
+		.preview_fname = preview_fname,
+		.wav_format = cs->wav_format,
+	};
+	dcaRunJobs(preview_fname ? 2 : 1, WriteJob, &jobs);
+	free(image);
+	if (preview_fname)
+		*preview_error = jobs.preview_error;
+	if (jobs.write_error != DCAE_OK)
+		return jobs.write_error;
 	
+	dcaLog(LOG_PROGRESS, "Wrote %u channel%s of %u samples at %u hz, in %s format\n",
+		cs->channel_cnt, cs->channel_cnt>1?"s":"", cs->samples_len, fDcaToAICAFrequency(cs->sample_rate_hz), fDaFormatString(cs->format));
 	
-	return written == head.chunk_size ? DCAE_OK : DCAE_WRITE_ERROR;
+	return DCAE_OK;
 }
  
\ No newline at end of file
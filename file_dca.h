@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 /*
 	Most functions provided by this header are provided as static inline, 
@@ -44,6 +45,9 @@
 //Has loop data
 #define DCA_FLAG_LOOPING	(1<<9)
 
+//Channels are interleaved in blocks of block_size bytes. Only in version 1 and later.
+#define DCA_FLAG_INTERLEAVED	(1<<10)
+
 #define DCA_LONG_THRESHOLD	((1<<16) - 64)
 
 //Bits from flags to write to AICA channel
@@ -75,7 +79,9 @@ typedef struct {
 	uint32_t chunk_size;
 	
 	/*
-		Version of file format. Currently only 0
+		Version of file format. 0, or 1 for files with 
+		DCA_FLAG_INTERLEAVED set. Readers that only understand version 
+		0 can't play interleaved files.
 	*/
 	uint8_t version;
 	
@@ -157,9 +163,11 @@ typedef struct {
 	uint32_t loop_end;
 	
 	/*
-		Not used in the current version
+		Size in bytes of each interleaved block, if 
+		DCA_FLAG_INTERLEAVED is set. Always a multiple of 32. Zero 
+		otherwise (this was unused padding in version 0).
 	*/
-	uint32_t padding1;
+	uint32_t block_size;
 	
 	/*
 		Sample data follows the header.
@@ -176,6 +184,15 @@ typedef struct {
 		
 		The size of all channels combined, in bytes, can be 
 		calculated using fDaGetDataSize.
+		
+		If DCA_FLAG_INTERLEAVED is set, each channel is instead split 
+		into blocks of block_size bytes, and the blocks are stored in 
+		turn: block 0 of every channel, then block 1 of every channel, 
+		and so on. Each channel is padded out to a whole number of 
+		blocks. This is meant for streaming long sounds: the next block 
+		of every channel is one contiguous read, and each block can be 
+		DMA'd straight to its channel's ring buffer. Use 
+		fDaGetChannelBlock to find a block.
 	*/
 } fDcAudioHeader;
 
@@ -324,12 +341,45 @@ size_t fDaCalcChannelSizeBytes(const fDcAudioHeader *dca);
 
 /*
 	Returns a pointer to the start of the samples for a channel.
+	
+	Channels are only contiguous if the file isn't interleaved. For 
+	interleaved files, use fDaGetChannelBlock or fDaCopyChannelBytes.
 */
 static inline void * fDaGetChannelSamples(fDcAudioHeader *dca, unsigned channel) {
 	char * ch = (char*)(dca+1);
 	return (void*)(ch + fDaCalcChannelSizeBytes(dca) * channel);
 }
 
+/*
+	Returns non-zero if channels are interleaved in blocks
+*/
+static inline unsigned fDaIsInterleaved(const fDcAudioHeader *dca) {
+	return dca->flags & DCA_FLAG_INTERLEAVED;
+}
+
+/*
+	Returns the number of blocks each channel is split into in an 
+	interleaved file.
+*/
+static inline size_t fDaGetBlockCount(const fDcAudioHeader *dca) {
+	return fDaCalcChannelSizeBytes(dca) / dca->block_size;
+}
+
+/*
+	Returns a pointer to a block of a channel in an interleaved file. 
+	Blocks are block_size bytes long.
+*/
+static inline void * fDaGetChannelBlock(fDcAudioHeader *dca, unsigned channel, size_t block) {
+	char * blocks = (char*)(dca+1);
+	return (void*)(blocks + (block * fDaGetChannelCount(dca) + channel) * dca->block_size);
+}
+
+/*
+	Copies len bytes of a channel starting at offset bytes into dst, 
+	for either layout.
+*/
+void fDaCopyChannelBytes(const fDcAudioHeader *dca, unsigned channel, size_t offset, void *dst, size_t len);
+
 /*
 	Returns the sample rate of the sound in hertz.
 	
@@ -354,6 +404,174 @@ static inline const char * fDaFormatStringHdr(const fDcAudioHeader *dca) {
 	return fDaFormatString(fDaGetSampleFormat(dca));
 }
 
+/*
+	Sound banks
+	
+	A bank packs many sounds into one contiguous blob, so a game can load 
+	a whole set of sounds with one read and one DMA into sound RAM, 
+	instead of opening and reading each .DCA file.
+	
+	A bank is laid out as:
+		fDcAudioBank header
+		Hash table of slot_cnt uint16_t entry indexes
+		entry_cnt fDcAudioBankEntry entries
+		Table of uint32_t channel offsets
+		Sample data
+	Each part starts on a 32 byte boundary. Every channel in the sample 
+	data is padded to 32 bytes, like in a .DCA file.
+	
+	Channels can share sample data, so several offsets may point to the 
+	same place, and a channel may be the start of a longer channel. In 
+	that case, its padding holds the longer channel's samples rather than 
+	zeros. Don't assume channels are stored in order or don't overlap.
+	
+	Sounds are looked up by a hash of their name (fDaHashName). The hash 
+	table is open addressed with linear probing, and is never more than 
+	half full, so lookups take a probe or two.
+	
+	Channel offsets are from the start of the bank. If the whole bank is 
+	copied to sound RAM, a channel is at the address it was copied to plus 
+	its offset. To save sound RAM, only the sample data can be copied 
+	(starting at data_offset), with data_offset subtracted from each 
+	channel offset. The header and tables are then only needed in main 
+	RAM.
+*/
+
+#define DCA_BANK_FOURCC_STR	"DcAB"
+#define DCA_BANK_FOURCC_UINT	0x42416344	//"DcAB" loaded as little endian int
+
+//Value of unused hash table slots
+#define DCA_BANK_EMPTY_SLOT	0xffff
+
+typedef struct {
+	//Always equal to "DcAB"
+	union {
+		char fourcc[4];
+		uint32_t fourcc_uint;
+	};
+	
+	//Size of the whole bank, including this header. Always a multiple of 32.
+	uint32_t chunk_size;
+	
+	//Version of the bank format. Currently only 0.
+	uint8_t version;
+	uint8_t padding0[3];
+	
+	//Number of sounds
+	uint16_t entry_cnt;
+	
+	//Number of hash table slots. Always a power of two.
+	uint16_t slot_cnt;
+	
+	//Offsets of each part from the start of the bank
+	uint32_t entries_offset;
+	uint32_t channels_offset;
+	uint32_t data_offset;
+	
+	uint32_t padding1;
+} fDcAudioBank;
+
+typedef struct {
+	//fDaHashName of the sound's name
+	uint32_t name_hash;
+	
+	//These have the same meaning as in fDcAudioHeader
+	uint16_t flags;
+	uint16_t sample_rate_aica;
+	uint32_t total_length;
+	uint32_t loop_start;
+	uint32_t loop_end;
+	
+	//Size of each channel in bytes, including padding
+	uint32_t channel_size;
+	
+	//Index of this sound's first channel in the channel offset table. 
+	//The other channels follow it.
+	uint32_t first_channel;
+	
+	uint32_t padding;
+} fDcAudioBankEntry;
+
+/*
+	Hashes a sound name for bank lookups (32-bit FNV-1a)
+*/
+static inline uint32_t fDaHashName(const char *name) {
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline const uint16_t * fDaBankGetSlots(const fDcAudioBank *bank) {
+	return (const uint16_t*)(bank+1);
+}
+
+static inline fDcAudioBankEntry * fDaBankGetEntry(fDcAudioBank *bank, unsigned index) {
+	return (fDcAudioBankEntry*)((char*)bank + bank->entries_offset) + index;
+}
+
+/*
+	Returns the entry for a name hash, or NULL if the bank doesn't have it.
+*/
+static inline fDcAudioBankEntry * fDaBankFindHash(fDcAudioBank *bank, uint32_t hash) {
+	const uint16_t *slots = fDaBankGetSlots(bank);
+	unsigned mask = bank->slot_cnt - 1;
+	for(unsigned slot = hash & mask; slots[slot] != DCA_BANK_EMPTY_SLOT; slot = (slot + 1) & mask) {
+		fDcAudioBankEntry *entry = fDaBankGetEntry(bank, slots[slot]);
+		if (entry->name_hash == hash)
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+	Returns the entry for a sound name, or NULL if the bank doesn't have it.
+*/
+static inline fDcAudioBankEntry * fDaBankFind(fDcAudioBank *bank, const char *name) {
+	return fDaBankFindHash(bank, fDaHashName(name));
+}
+
+/*
+	Returns the offset of a channel's samples from the start of the bank
+*/
+static inline uint32_t fDaBankGetChannelOffset(const fDcAudioBank *bank, const fDcAudioBankEntry *entry, unsigned channel) {
+	const uint32_t *offsets = (const uint32_t*)((const char*)bank + bank->channels_offset);
+	return offsets[entry->first_channel + channel];
+}
+
+/*
+	Returns a pointer to the start of the samples for a channel.
+*/
+static inline void * fDaBankGetChannelSamples(fDcAudioBank *bank, const fDcAudioBankEntry *entry, unsigned channel) {
+	return (char*)bank + fDaBankGetChannelOffset(bank, entry, channel);
+}
+
+/*
+	Fills in a .DCA header for an entry, so the fDa* functions for 
+	headers (such as fDaGetAICALength) can be used on it. The header 
+	isn't followed by samples, so use fDaBankGetChannelSamples instead of 
+	fDaGetChannelSamples.
+*/
+static inline void fDaBankGetHeader(const fDcAudioBankEntry *entry, fDcAudioHeader *dca) {
+	memset(dca, 0, sizeof(*dca));
+	dca->fourcc_uint = DCA_FOURCC_UINT;
+	dca->flags = entry->flags;
+	dca->sample_rate_aica = entry->sample_rate_aica;
+	dca->total_length = entry->total_length;
+	dca->loop_start = entry->loop_start;
+	dca->loop_end = entry->loop_end;
+	dca->chunk_size = sizeof(*dca) + entry->channel_size * fDaGetChannelCount(dca);
+}
+
+/*
+	Returns true if a bank of size bytes is well formed, with every table 
+	and channel inside the bank. Check this before using a bank from an 
+	untrusted source.
+*/
+int fDaBankValidate(const fDcAudioBank *bank, size_t size);
+
 #ifdef DCAUDIO_IMPLEMENTATION
 size_t fDaCalcChannelSizeBytes(const fDcAudioHeader *dca) {
 	size_t sz = dca->total_length;
@@ -364,7 +582,29 @@ size_t fDaCalcChannelSizeBytes(const fDcAudioHeader *dca) {
 		//Round up to whole byte
 		sz = (sz+1) / 2;
 	}
-	return (sz + DCA_ALIGNMENT_MASK) & ~DCA_ALIGNMENT_MASK;
+	//Interleaved channels are padded to a whole number of blocks
+	size_t align = fDaIsInterleaved(dca) ? dca->block_size : DCA_ALIGNMENT;
+	return (sz + align - 1) / align * align;
+}
+
+void fDaCopyChannelBytes(const fDcAudioHeader *dca, unsigned channel, size_t offset, void *dst, size_t len) {
+	if (!fDaIsInterleaved(dca)) {
+		memcpy(dst, (const char*)fDaGetChannelSamples((fDcAudioHeader*)dca, channel) + offset, len);
+		return;
+	}
+	
+	char *out = dst;
+	while (len > 0) {
+		size_t block = offset / dca->block_size;
+		size_t in_block = offset % dca->block_size;
+		size_t n = dca->block_size - in_block;
+		if (n > len)
+			n = len;
+		memcpy(out, (const char*)fDaGetChannelBlock((fDcAudioHeader*)dca, channel, block) + in_block, n);
+		out += n;
+		offset += n;
+		len -= n;
+	}
 }
 
 unsigned fDaConvertFrequency(unsigned int freq_hz) {
@@ -405,7 +645,7 @@ int fDaValidateHeader(const fDcAudioHeader *dca) {
 	//Check fourcc matches
 	valid &= fDaFourccMatches(dca);
 	
-	//Currently, only version is 0. There will probably not be more than 50 versions,
+	//Currently, only versions are 0 and 1. There will probably not be more than 50 versions,
 	//so anything more than that is suspicious
 	valid &= fDaGetVersion(dca) < 50;
 	
@@ -415,6 +655,14 @@ int fDaValidateHeader(const fDcAudioHeader *dca) {
 	//Check for invalid format
 	valid &= fDaGetSampleFormat(dca) != DCA_FLAG_FORMAT_INVALID;
 	
+	//Interleaved blocks must keep every block aligned
+	if (fDaIsInterleaved(dca)) {
+		valid &= fDaGetVersion(dca) >= 1;
+		valid &= dca->block_size != 0 && (dca->block_size % DCA_ALIGNMENT) == 0;
+	}
+	if (!valid)
+		return false;
+	
 	//Check size is right
 	valid &= fDaGetFileSize(dca) == (sizeof(fDcAudioHeader) + fDaGetChannelCount(dca) * fDaCalcChannelSizeBytes(dca));
 	
@@ -437,6 +685,50 @@ const char * fDaFormatString(unsigned format) {
 	
 	return fmtstrs[format];
 }
+
+int fDaBankValidate(const fDcAudioBank *bank, size_t size) {
+	if (bank == NULL || size < sizeof(fDcAudioBank))
+		return false;
+	if (bank->fourcc_uint != DCA_BANK_FOURCC_UINT || bank->version != 0)
+		return false;
+	if (bank->chunk_size > size || bank->chunk_size % DCA_ALIGNMENT)
+		return false;
+	
+	//Hash table must have a free slot, or lookups for missing sounds never end
+	if (bank->slot_cnt == 0 || (bank->slot_cnt & (bank->slot_cnt - 1)) || bank->slot_cnt <= bank->entry_cnt)
+		return false;
+	if (sizeof(fDcAudioBank) + bank->slot_cnt * sizeof(uint16_t) > bank->entries_offset)
+		return false;
+	if (bank->entries_offset + (size_t)bank->entry_cnt * sizeof(fDcAudioBankEntry) > bank->channels_offset)
+		return false;
+	if (bank->channels_offset > bank->data_offset || bank->data_offset > bank->chunk_size)
+		return false;
+	
+	const uint16_t *slots = fDaBankGetSlots(bank);
+	for(unsigned i = 0; i < bank->slot_cnt; i++)
+		if (slots[i] != DCA_BANK_EMPTY_SLOT && slots[i] >= bank->entry_cnt)
+			return false;
+	
+	size_t channel_cnt = (bank->data_offset - bank->channels_offset) / sizeof(uint32_t);
+	for(unsigned i = 0; i < bank->entry_cnt; i++) {
+		const fDcAudioBankEntry *entry = fDaBankGetEntry((fDcAudioBank*)bank, i);
+		fDcAudioHeader dca;
+		fDaBankGetHeader(entry, &dca);
+		if (!fDaValidateHeader(&dca) || fDaIsInterleaved(&dca))
+			return false;
+		
+		unsigned channels = fDaGetChannelCount(&dca);
+		if (entry->first_channel + (size_t)channels > channel_cnt)
+			return false;
+		for(unsigned c = 0; c < channels; c++) {
+			uint32_t offset = fDaBankGetChannelOffset(bank, entry, c);
+			if (offset < bank->data_offset || offset % DCA_ALIGNMENT || (size_t)offset + entry->channel_size > bank->chunk_size)
+				return false;
+		}
+	}
+	
+	return true;
+}
 #endif
 
 #endif
\ No newline at end of file
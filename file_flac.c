@@ -1,24 +1,162 @@
 #include "dca_conv.h"
+#include "parallel.h"
+#include "cpu.h"
 
 #define DR_FLAC_IMPLEMENTATION
 #include "dr_flac.h"
 
-dcaError fFlacLoad(DcAudioConverter *dcac, const char *fname) {
-	unsigned channel_cnt = 0;
-	unsigned sample_rate_hz = 0;
-	drflac_uint64 samples_len = 0;
+/*
+	FLAC frames can be decoded independently, so long files are split
+	into ranges of PCM frames that are decoded on separate threads. Each
+	job opens its own decoder on the shared mapping and seeks to the start
+	of its range. dr_flac finds the frame containing that position with
+	the SEEKTABLE if there is one, or by searching for frame sync codes
+	otherwise, so the output is identical to decoding straight through.
 	
-	short *output = drflac_open_file_and_read_pcm_frames_s16(fname, &channel_cnt, &sample_rate_hz, &samples_len, NULL);
-	if (output == NULL) {
+	Ranges are never shorter than this many frames, so short files
+	aren't slowed down by the extra decoder setup.
+*/
+#define FLAC_MIN_JOB_FRAMES	(1<<16)
+
+typedef struct {
+	const dcaMappedFile *mf;
+	DcAudioConverter *dcac;
+	//Range of PCM frames to decode
+	drflac_uint64 start, end;
+	unsigned job_cnt;
+	bool failed;
+} FlacJobs;
+
+static void DecodeFlacRange(void *ctx, unsigned job) {
+	FlacJobs *jobs = ctx;
+	DcAudioConverter *dcac = jobs->dcac;
+	const drflac_uint64 len = jobs->end - jobs->start;
+	drflac_uint64 pos = jobs->start + len * job / jobs->job_cnt;
+	drflac_uint64 end = jobs->start + len * (job + 1) / jobs->job_cnt;
+	
+	drflac *flac = drflac_open_memory(jobs->mf->data, jobs->mf->size, NULL);
+	if (flac == NULL) {
+		__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+	
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / dcac->channel_cnt;
+	bool ok = drflac_seek_to_pcm_frame(flac, pos);
+	while (ok && pos < end) {
+		drflac_uint64 want = end - pos < block_frames ? end - pos : block_frames;
+		drflac_uint64 frames = drflac_read_pcm_frames_s16(flac, want, block);
+		if (frames == 0)
+			break;
+		//Ranges don't overlap, so jobs can write to the output at the same time
+		dcaCpu.deinterleave(dcac->samples, pos - jobs->start, block, dcac->channel_cnt, frames);
+		pos += frames;
+	}
+	if (!ok || pos != end)
+		__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+	
+	drflac_close(flac);
+}
+
+//Returns false if any part of the file couldn't be decoded
+static bool FlacLoadParallel(DcAudioConverter *dcac, const dcaMappedFile *mf, drflac_uint64 start, drflac_uint64 end, unsigned job_cnt) {
+	FlacJobs jobs = {
+		.mf = mf,
+		.dcac = dcac,
+		.start = start,
+		.end = end,
+		.job_cnt = job_cnt,
+		.failed = false,
+	};
+	
+	dcaLog(LOG_INFO, "Decoding FLAC in %u parts\n", job_cnt);
+	dcaRunJobs(job_cnt, DecodeFlacRange, &jobs);
+	if (jobs.failed)
+		return false;
+	
+	dcac->samples_len = end - start;
+	return true;
+}
+
+dcaError fFlacLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf) {
+	dcaError retval = DCAE_OK;
+	
+	drflac *flac = drflac_open_memory(mf->data, mf->size, NULL);
+	if (flac == NULL)
 		return DCAE_READ_OPEN_ERROR;
+	
+	dcac->sample_rate_hz = flac->sampleRate;
+	
+	uint64_t start, end;
+	dcaGetRange(dcac, flac->sampleRate, &start, &end);
+	//totalPCMFrameCount is 0 if the stream doesn't say how long it is
+	if (flac->totalPCMFrameCount != 0 && end > flac->totalPCMFrameCount)
+		end = flac->totalPCMFrameCount;
+	if (start > 0 && start >= end) {
+		retval = DCAE_BAD_RANGE;
+		goto cleanup;
+	}
+	
+	//0 if the length isn't known
+	const drflac_uint64 len = end != UINT64_MAX ? end - start : 0;
+	retval = dcaInitSamples(dcac, flac->channels, len);
+	if (retval != DCAE_OK)
+		goto cleanup;
+	
+	//Only split ranges with a known length, since they have to be worked out up front
+	unsigned job_cnt = dcaJobThreads();
+	if (job_cnt > len / FLAC_MIN_JOB_FRAMES)
+		job_cnt = len / FLAC_MIN_JOB_FRAMES;
+	if (job_cnt > 1) {
+		if (FlacLoadParallel(dcac, mf, start, end, job_cnt))
+			goto cleanup;
+		dcaLog(LOG_INFO, "Parallel FLAC decode failed, decoding serially\n");
+	}
+	
+	//Frames are independent, so seeking gives the same samples as decoding from the start
+	if (start > 0 && !drflac_seek_to_pcm_frame(flac, start)) {
+		retval = DCAE_READ_ERROR;
+		goto cleanup;
+	}
+	
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / flac->channels;
+	while (dcac->samples_len < end - start) {
+		drflac_uint64 want = end - start - dcac->samples_len < block_frames ? end - start - dcac->samples_len : block_frames;
+		drflac_uint64 frames = drflac_read_pcm_frames_s16(flac, want, block);
+		if (frames == 0)
+			break;
+		retval = dcaAppendInterleaved(dcac, block, frames);
+		if (retval != DCAE_OK)
+			goto cleanup;
+	}
+	
+	if (len != 0 && dcac->samples_len != len)
+		dcaLog(LOG_WARNING, "Short read of %u samples out of %u\n", (unsigned)dcac->samples_len, (unsigned)len);
+	if (dcac->samples_len == 0 && start > 0) {
+		retval = DCAE_BAD_RANGE;
+		goto cleanup;
 	}
+	dcaFinishSamples(dcac);
+	
+cleanup:
+	drflac_close(flac);
 	
-	dcac->samples_len = samples_len;
-	dcac->sample_rate_hz = sample_rate_hz;
-	dcac->channel_cnt = channel_cnt;
-	dcaDeinterleaveSamples(dcac, output, samples_len, channel_cnt);
+	return retval;
+}
+
+dcaError fFlacInfo(dcaFileInfo *info, const char *fname) {
+	//Opening only reads STREAMINFO and steps over the other metadata blocks
+	drflac *flac = drflac_open_file(fname, NULL);
+	if (flac == NULL)
+		return DCAE_READ_OPEN_ERROR;
 	
-	free(output);
+	info->type = "FLAC";
+	info->channel_cnt = flac->channels;
+	info->sample_rate_hz = flac->sampleRate;
+	info->samples_len = flac->totalPCMFrameCount;
+	info->bits_per_sample = flac->bitsPerSample;
 	
+	drflac_close(flac);
 	return DCAE_OK;
 }
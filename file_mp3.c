@@ -1,25 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
 #include "dca_conv.h"
+#include "parallel.h"
+#include "cpu.h"
 
 #define DR_MP3_IMPLEMENTATION
 #include "dr_mp3.h"
 
-dcaError fMp3Load(DcAudioConverter *dcac, const char *fname) {
-	drmp3_config mp3info;
-	drmp3_uint64 samples_len = 0;
+/*
+	Long MP3s are split into ranges of MP3 frames that are decoded on
+	separate threads. Unlike FLAC, MP3 frames aren't independent. A Layer
+	III frame can take part of its data from up to 511 bytes of earlier
+	frames (the bit reservoir), and its output depends on the overlap-add
+	and synthesis filter state left by the frame before it.
+
+	First, the stream is scanned once without decoding any audio, stepping
+	through it exactly like dr_mp3 does, to find where each frame starts
+	and where its samples go in the output. Each job then starts decoding
+	a few frames before its range, far enough back to fill the reservoir,
+	and throws away the output of those warm-up frames. The last two
+	warm-up frames must decode successfully, which leaves the overlap and
+	filter state the same as it is in a serial decode. Jobs also check
+	that every frame they decode lines up with the scan. If anything
+	doesn't match, the file is decoded serially instead, so the result is
+	always identical to a serial decode.
+	
+	The same scan is used for --range, even on one thread, so that only
+	the frames around the range are decoded.
+*/
+
+//Ranges are never shorter than this many MP3 frames (about 7 seconds at 44.1 kHz)
+#define MP3_MIN_JOB_FRAMES	256
+//Most bytes a frame can use from earlier frames
+#define MP3_RESERVOIR_BYTES	511
+//Header, CRC, and largest side info. The rest of a frame is reservoir data.
+#define MP3_FRAME_OVERHEAD	38
+//Frames before a range that must decode successfully
+#define MP3_STATE_FRAMES	2
+
+typedef struct {
+	//Where dr_mp3 starts reading for this frame. This is before the header if there is junk before it.
+	size_t offset;
+	//Position of the frame's first sample in the output
+	drmp3_uint64 pcm_pos;
+} Mp3Frame;
+
+typedef struct {
+	const dcaMappedFile *mf;
+	DcAudioConverter *dcac;
+	//Every frame that produces samples, plus one past the end giving the end of the stream and the total length
+	Mp3Frame *frames;
+	size_t frame_cnt;
+	//Samples to keep, and the frames that hold them
+	drmp3_uint64 start, end;
+	size_t first_frame, end_frame;
+	unsigned job_cnt;
+	bool failed;
+} Mp3Jobs;
+
+/*
+	Finds all frames that produce samples. Passing NULL for the output
+	makes dr_mp3 skip decoding audio, but it still handles the reservoir
+	the same way. Returns false if the stream can't be split, such as if
+	the channel count or sample rate change partway through.
+*/
+static bool Mp3ScanFrames(Mp3Jobs *jobs, unsigned channels, unsigned rate) {
+	const drmp3_uint8 *data = jobs->mf->data;
+	const size_t size = jobs->mf->size;
+	if (size > INT_MAX)
+		return false;
+	
+	size_t capacity = 1024;
+	jobs->frames = malloc(capacity * sizeof(Mp3Frame));
+	jobs->frame_cnt = 0;
+	if (jobs->frames == NULL)
+		return false;
+	
+	drmp3dec dec;
+	memset(&dec, 0, sizeof(dec));
+	drmp3dec_init(&dec);
+	
+	size_t pos = 0;
+	drmp3_uint64 pcm_pos = 0;
+	while (pos < size) {
+		drmp3dec_frame_info info;
+		int samples = drmp3dec_decode_frame(&dec, data + pos, size - pos, NULL, &info);
+		if (samples > 0) {
+			if ((unsigned)info.channels != channels || (unsigned)info.hz != rate)
+				return false;
+			//Leave room for the end marker
+			if (jobs->frame_cnt + 1 >= capacity) {
+				capacity *= 2;
+				Mp3Frame *grown = realloc(jobs->frames, capacity * sizeof(Mp3Frame));
+				if (grown == NULL)
+					return false;
+				jobs->frames = grown;
+			}
+			jobs->frames[jobs->frame_cnt].offset = pos;
+			jobs->frames[jobs->frame_cnt].pcm_pos = pcm_pos;
+			jobs->frame_cnt++;
+			pcm_pos += samples;
+		} else if (info.frame_bytes == 0) {
+			break;
+		}
+		pos += info.frame_bytes;
+	}
+	
+	jobs->frames[jobs->frame_cnt].offset = pos;
+	jobs->frames[jobs->frame_cnt].pcm_pos = pcm_pos;
+	return true;
+}
+
+static void DecodeMp3Range(void *ctx, unsigned job) {
+	Mp3Jobs *jobs = ctx;
+	DcAudioConverter *dcac = jobs->dcac;
+	const drmp3_uint8 *data = jobs->mf->data;
+	const size_t size = jobs->mf->size;
+	const Mp3Frame *frames = jobs->frames;
+	const size_t range_frames = jobs->end_frame - jobs->first_frame;
+	size_t first = jobs->first_frame + range_frames * job / jobs->job_cnt;
+	size_t end = jobs->first_frame + range_frames * (job + 1) / jobs->job_cnt;
+	
+	//Frames that must decode correctly before the range starts
+	size_t settle = first > MP3_STATE_FRAMES ? first - MP3_STATE_FRAMES : 0;
+	//Go back far enough to fill the reservoir before those
+	size_t start = settle;
+	size_t reservoir = 0;
+	while (start > 0 && reservoir < MP3_RESERVOIR_BYTES) {
+		start--;
+		size_t frame_bytes = frames[start+1].offset - frames[start].offset;
+		if (frame_bytes > MP3_FRAME_OVERHEAD)
+			reservoir += frame_bytes - MP3_FRAME_OVERHEAD;
+	}
+	
+	drmp3dec dec;
+	memset(&dec, 0, sizeof(dec));
+	drmp3dec_init(&dec);
+	drmp3_int16 pcm[DRMP3_MAX_SAMPLES_PER_FRAME];
+	
+	size_t pos = frames[start].offset;
+	size_t next = start;
+	while (next < end && pos < size) {
+		drmp3dec_frame_info info;
+		int samples = drmp3dec_decode_frame(&dec, data + pos, size - pos, pcm, &info);
+		if (samples > 0) {
+			//Frames the scan found are the only ones that can produce samples
+			while (next < end && frames[next].offset < pos) {
+				//Skipped a frame. That's expected while filling the reservoir, but not after.
+				if (next >= settle)
+					goto fail;
+				next++;
+			}
+			if (next == end || frames[next].offset != pos)
+				goto fail;
+			if (next >= first) {
+				//Frames at the ends of the range are only partly inside it
+				drmp3_uint64 frame_pos = frames[next].pcm_pos;
+				size_t skip = frame_pos < jobs->start ? jobs->start - frame_pos : 0;
+				size_t keep = frame_pos + samples > jobs->end ? jobs->end - frame_pos : (size_t)samples;
+				dcaCpu.deinterleave(dcac->samples, frame_pos + skip - jobs->start, pcm + skip * dcac->channel_cnt, dcac->channel_cnt, keep - skip);
+			}
+			next++;
+		} else if (info.frame_bytes == 0) {
+			break;
+		}
+		pos += info.frame_bytes;
+	}
+	if (next == end)
+		return;
+	
+fail:
+	__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+}
+
+//Returns false if the file couldn't be decoded from the scan
+static bool Mp3LoadParallel(DcAudioConverter *dcac, const dcaMappedFile *mf, unsigned channels, unsigned rate, drmp3_uint64 start, drmp3_uint64 end) {
+	bool success = false;
+	Mp3Jobs jobs = {
+		.mf = mf,
+		.dcac = dcac,
+		.start = start,
+		.failed = false,
+	};
+	
+	if (!Mp3ScanFrames(&jobs, channels, rate))
+		goto cleanup;
+	
+	drmp3_uint64 total = jobs.frames[jobs.frame_cnt].pcm_pos;
+	jobs.end = end < total ? end : total;
+	if (start >= jobs.end)
+		goto cleanup;
+	
+	//Last frame starting at or before the start, and first frame starting at or after the end
+	size_t lo = 0, hi = jobs.frame_cnt;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (jobs.frames[mid].pcm_pos <= start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	jobs.first_frame = lo;
+	jobs.end_frame = jobs.first_frame;
+	while (jobs.frames[jobs.end_frame].pcm_pos < jobs.end)
+		jobs.end_frame++;
+	
+	jobs.job_cnt = dcaJobThreads();
+	if (jobs.job_cnt > (jobs.end_frame - jobs.first_frame) / MP3_MIN_JOB_FRAMES)
+		jobs.job_cnt = (jobs.end_frame - jobs.first_frame) / MP3_MIN_JOB_FRAMES;
+	if (jobs.job_cnt < 1)
+		jobs.job_cnt = 1;
+	//A serial decode is just as fast for a whole file on one thread
+	if (jobs.job_cnt == 1 && start == 0 && jobs.end == total)
+		goto cleanup;
+	
+	if (dcaInitSamples(dcac, channels, jobs.end - start) != DCAE_OK)
+		goto cleanup;
+	
+	dcaLog(LOG_INFO, "Decoding MP3 in %u parts\n", jobs.job_cnt);
+	dcaRunJobs(jobs.job_cnt, DecodeMp3Range, &jobs);
+	if (jobs.failed) {
+		dcaLog(LOG_INFO, "Parallel MP3 decode failed, decoding serially\n");
+		goto cleanup;
+	}
+	
+	dcac->samples_len = jobs.end - start;
+	success = true;
 	
-	short *output = drmp3_open_file_and_read_pcm_frames_s16(fname, &mp3info, &samples_len, NULL);
-	if (output == NULL) {
+cleanup:
+	free(jobs.frames);
+	return success;
+}
+
+dcaError fMp3LoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf) {
+	drmp3 mp3;
+	
+	dcaError retval = DCAE_OK;
+	
+	if (!drmp3_init_memory(&mp3, mf->data, mf->size, NULL))
+		return DCAE_READ_OPEN_ERROR;
+	
+	dcac->sample_rate_hz = mp3.sampleRate;
+	
+	uint64_t start, end;
+	dcaGetRange(dcac, mp3.sampleRate, &start, &end);
+	bool whole_file = start == 0 && end == UINT64_MAX;
+	
+	if ((dcaJobThreads() > 1 || !whole_file) && Mp3LoadParallel(dcac, mf, mp3.channels, mp3.sampleRate, start, end))
+		goto cleanup;
+	
+	//If the parallel decode failed, its buffers are already the right size. Otherwise, dr_mp3
+	//can only get the length by decoding the whole file, so let the buffers grow instead.
+	if (dcac->samples[0] == NULL) {
+		retval = dcaInitSamples(dcac, mp3.channels, 0);
+		if (retval != DCAE_OK)
+			goto cleanup;
+	}
+	
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / mp3.channels;
+	drmp3_uint64 frames, pos = 0;
+	while (pos < end && (frames = drmp3_read_pcm_frames_s16(&mp3, block_frames, block)) > 0) {
+		retval = dcaAppendInterleavedRange(dcac, block, frames, pos, start, end);
+		if (retval != DCAE_OK)
+			goto cleanup;
+		pos += frames;
+	}
+	
+	if (dcac->samples_len == 0 && !whole_file) {
+		retval = DCAE_BAD_RANGE;
+		goto cleanup;
+	}
+	dcaFinishSamples(dcac);
+	
+cleanup:
+	drmp3_uninit(&mp3);
+	
+	return retval;
+}
+
+/*
+	--info only looks at the first frame. If it has a Xing or Info tag
+	(written by LAME and most other encoders) the tag gives the number of
+	frames. Otherwise the length is estimated from the file size and the
+	first frame's bitrate, which is exact for constant bitrate files
+	without trailing tags.
+*/
+
+//Bytes read after any ID3v2 tag to find the first frame
+#define MP3_PROBE_BYTES	(16*1024)
+
+static drmp3_uint32 ReadBE32(const drmp3_uint8 *p) {
+	return (drmp3_uint32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+//Returns the number of frames given by a Xing/Info tag in the frame at hdr, or 0 if it doesn't have one
+static drmp3_uint32 Mp3XingFrames(const drmp3_uint8 *hdr, size_t frame_size) {
+	//The tag goes where the main data would start, after the side info
+	size_t offset = DRMP3_HDR_SIZE + (DRMP3_HDR_IS_CRC(hdr) ? 2 : 0);
+	if (DRMP3_HDR_TEST_MPEG1(hdr))
+		offset += DRMP3_HDR_IS_MONO(hdr) ? 17 : 32;
+	else
+		offset += DRMP3_HDR_IS_MONO(hdr) ? 9 : 17;
+	
+	const drmp3_uint8 *tag = hdr + offset;
+	if (offset + 12 > frame_size)
+		return 0;
+	if (memcmp(tag, "Xing", 4) != 0 && memcmp(tag, "Info", 4) != 0)
+		return 0;
+	//Frame count is only there if the first flag is set
+	if ((ReadBE32(tag + 4) & 1) == 0)
+		return 0;
+	return ReadBE32(tag + 8);
+}
+
+dcaError fMp3Info(dcaFileInfo *info, const char *fname) {
+	FILE *f = fopen(fname, "rb");
+	if (f == NULL)
 		return DCAE_READ_OPEN_ERROR;
+	
+	drmp3_uint8 buf[MP3_PROBE_BYTES];
+	dcaError retval = DCAE_READ_ERROR;
+	
+	if (fseek(f, 0, SEEK_END) != 0)
+		goto cleanup;
+	long file_size = ftell(f);
+	rewind(f);
+	
+	//Skip over an ID3v2 tag, which can be large if it holds cover art
+	long start = 0;
+	if (fread(buf, 1, 10, f) == 10 && memcmp(buf, "ID3", 3) == 0) {
+		start = 10 + ((buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 | (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f));
+		//Footer
+		if (buf[5] & 0x10)
+			start += 10;
 	}
+	if (start >= file_size || fseek(f, start, SEEK_SET) != 0)
+		goto cleanup;
+	size_t len = fread(buf, 1, sizeof(buf), f);
+	
+	drmp3dec dec;
+	memset(&dec, 0, sizeof(dec));
+	drmp3dec_init(&dec);
+	drmp3dec_frame_info frame;
+	int frame_samples = drmp3dec_decode_frame(&dec, buf, len, NULL, &frame);
+	if (frame_samples <= 0)
+		goto cleanup;
 	
-	dcac->samples_len = samples_len;
-	dcac->sample_rate_hz = mp3info.sampleRate;
-	dcac->channel_cnt = mp3info.channels;
-	dcaDeinterleaveSamples(dcac, output, samples_len, mp3info.channels);
+	//frame_bytes includes any junk skipped before the frame
+	size_t frame_size = drmp3_hdr_frame_bytes(dec.header, dec.free_format_bytes) + drmp3_hdr_padding(dec.header);
+	const drmp3_uint8 *hdr = buf + frame.frame_bytes - frame_size;
 	
-	dcaLog(LOG_WARNING, "%u, %u\n",  dcac->sample_rate_hz, dcac->channel_cnt);
+	info->type = "MP3";
+	info->channel_cnt = frame.channels;
+	info->sample_rate_hz = frame.hz;
+	info->bitrate_kbps = frame.bitrate_kbps;
 	
-	drmp3_free(output, NULL);
+	long stream_bytes = file_size - start - (long)(frame.frame_bytes - frame_size);
+	drmp3_uint32 frame_cnt = Mp3XingFrames(hdr, frame_size);
+	if (frame_cnt > 0) {
+		//dr_mp3 doesn't recognize the tag, so the tag's own frame comes out as silence
+		info->samples_len = (drmp3_uint64)(frame_cnt + 1) * frame_samples;
+		//The tag frame's bitrate means nothing for VBR files, so use the average
+		info->bitrate_kbps = (drmp3_uint64)stream_bytes * 8 * frame.hz / (info->samples_len * 1000);
+	} else if (frame.bitrate_kbps > 0) {
+		info->samples_len = (drmp3_uint64)stream_bytes * 8 * frame.hz / (frame.bitrate_kbps * 1000);
+		info->len_estimated = true;
+	}
+	retval = DCAE_OK;
 	
-	return DCAE_OK;
+cleanup:
+	fclose(f);
+	return retval;
 }
@@ -1,27 +1,257 @@
+#include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "dca_conv.h"
+#include "parallel.h"
+#include "cpu.h"
 
 #define STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
 
+/*
+	Long Vorbis files are split into ranges of samples that are decoded
+	on separate threads, each with its own decoder on the shared mapping.
+	stb_vorbis_seek finds the page holding a sample by bisecting on the Ogg
+	page granule positions.
 
-dcaError fVorbisLoad(DcAudioConverter *dcac, const char *fname) {
-	int channel_cnt = 0;
-	int sample_rate_hz = 0;
-	short *output = NULL;
+	Each Vorbis packet's output is overlap-added with the end of the
+	previous packet. stb_vorbis_seek primes that overlap itself, but
+	every job except the first also seeks a little before its range and
+	throws away the warm-up samples, so exactness doesn't depend on that
+	detail. The warm-up covers two of the longest blocks, so the overlap at
+	the start of the range always comes from packets that were decoded
+	normally, and the output is the same as decoding straight through.
+	The last job has to end exactly at the length given by the last page,
+	otherwise the whole file is decoded serially instead.
 	
-	int vorblen = stb_vorbis_decode_filename(fname, &channel_cnt, &sample_rate_hz, &output);
-	if (vorblen <= 0) {
+	--range uses the same jobs, even on one thread, so only the part of
+	the file around the range is decoded.
+
+	Ranges are never shorter than this many samples.
+*/
+#define VORBIS_MIN_JOB_SAMPLES	(1<<17)
+
+typedef struct {
+	DcAudioConverter *dcac;
+	//Decoder for each job. They're opened before starting the jobs, since
+	//stb_vorbis sets up shared tables when the first one is opened.
+	stb_vorbis **decoders;
+	//Samples to decode, and the length of the stream
+	size_t start, end, total_samples;
+	unsigned warmup_samples;
+	unsigned job_cnt;
+	bool failed;
+} VorbisJobs;
+
+static void DecodeVorbisRange(void *ctx, unsigned job) {
+	VorbisJobs *jobs = ctx;
+	DcAudioConverter *dcac = jobs->dcac;
+	stb_vorbis *vorb = jobs->decoders[job];
+	const unsigned channels = dcac->channel_cnt;
+	const size_t len = jobs->end - jobs->start;
+	size_t start = jobs->start + len * job / jobs->job_cnt;
+	size_t end = jobs->start + len * (job + 1) / jobs->job_cnt;
+	
+	size_t pos = 0;
+	if (start > jobs->warmup_samples) {
+		pos = start - jobs->warmup_samples;
+		if (!stb_vorbis_seek(vorb, pos))
+			goto fail;
+	}
+	
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / channels;
+	while (pos < end) {
+		size_t want = end - pos < block_frames ? end - pos : block_frames;
+		int frames = stb_vorbis_get_samples_short_interleaved(vorb, channels, block, want * channels);
+		if (frames <= 0)
+			break;
+		
+		//Skip warm-up samples
+		size_t skip = pos < start ? start - pos : 0;
+		if (skip < (size_t)frames)
+			dcaCpu.deinterleave(dcac->samples, pos + skip - jobs->start, block + skip * channels, channels, frames - skip);
+		pos += frames;
+	}
+	if (pos != end)
+		goto fail;
+	
+	//The stream must end exactly where the last page said it would
+	if (end == jobs->total_samples && stb_vorbis_get_samples_short_interleaved(vorb, channels, block, channels) != 0)
+		goto fail;
+	return;
+	
+fail:
+	__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+}
+
+//Returns false if the file couldn't be decoded in parallel
+static bool VorbisLoadParallel(DcAudioConverter *dcac, const dcaMappedFile *mf, stb_vorbis_info *info, size_t start, size_t end, size_t total_samples) {
+	bool success = false;
+	VorbisJobs jobs = {
+		.dcac = dcac,
+		.start = start,
+		.end = end,
+		.total_samples = total_samples,
+		.warmup_samples = 4 * info->max_frame_size,
+		.failed = false,
+	};
+	
+	jobs.job_cnt = dcaJobThreads();
+	if (jobs.job_cnt > (end - start) / VORBIS_MIN_JOB_SAMPLES)
+		jobs.job_cnt = (end - start) / VORBIS_MIN_JOB_SAMPLES;
+	if (jobs.job_cnt < 1)
+		jobs.job_cnt = 1;
+	//A serial decode is just as fast for a whole file on one thread
+	if (jobs.job_cnt == 1 && start == 0 && end == total_samples)
+		return false;
+	
+	jobs.decoders = calloc(jobs.job_cnt, sizeof(stb_vorbis*));
+	if (jobs.decoders == NULL)
+		return false;
+	for(unsigned i = 0; i < jobs.job_cnt; i++) {
+		int err = 0;
+		jobs.decoders[i] = stb_vorbis_open_memory(mf->data, mf->size, &err, NULL);
+		if (jobs.decoders[i] == NULL)
+			goto cleanup;
+	}
+	
+	dcaLog(LOG_INFO, "Decoding Vorbis in %u parts\n", jobs.job_cnt);
+	dcaRunJobs(jobs.job_cnt, DecodeVorbisRange, &jobs);
+	if (jobs.failed) {
+		dcaLog(LOG_INFO, "Parallel Vorbis decode failed, decoding serially\n");
+		goto cleanup;
+	}
+	
+	dcac->samples_len = end - start;
+	success = true;
+	
+cleanup:
+	for(unsigned i = 0; i < jobs.job_cnt; i++)
+		if (jobs.decoders[i] != NULL)
+			stb_vorbis_close(jobs.decoders[i]);
+	free(jobs.decoders);
+	return success;
+}
+
+dcaError fVorbisLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf) {
+	dcaError retval = DCAE_OK;
+	
+	//stb_vorbis takes the length as an int
+	if (mf->size > INT_MAX)
+		return DCAE_TOO_LONG;
+	
+	int err = 0;
+	stb_vorbis *vorb = stb_vorbis_open_memory(mf->data, mf->size, &err, NULL);
+	if (vorb == NULL)
 		return DCAE_READ_OPEN_ERROR;
+	
+	stb_vorbis_info info = stb_vorbis_get_info(vorb);
+	//0 if the length isn't known
+	size_t total_samples = stb_vorbis_stream_length_in_samples(vorb);
+	dcac->sample_rate_hz = info.sample_rate;
+	
+	uint64_t start, end;
+	dcaGetRange(dcac, info.sample_rate, &start, &end);
+	if (total_samples != 0 && end > total_samples)
+		end = total_samples;
+	if (start > 0 && start >= end) {
+		retval = DCAE_BAD_RANGE;
+		goto cleanup;
 	}
 	
-	dcac->samples_len = vorblen;
-	dcac->sample_rate_hz = sample_rate_hz;
-	dcac->channel_cnt = channel_cnt;
-	dcaDeinterleaveSamples(dcac, output, vorblen, channel_cnt);
+	retval = dcaInitSamples(dcac, info.channels, total_samples != 0 ? end - start : 0);
+	if (retval != DCAE_OK)
+		goto cleanup;
+	
+	//Jobs need the length to split the file and check the end
+	if (total_samples != 0 && VorbisLoadParallel(dcac, mf, &info, start, end, total_samples))
+		goto cleanup;
 	
-	free(output);
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const int block_samples = DCA_DECODE_BLOCK_SAMPLES / info.channels * info.channels;
+	uint64_t pos = 0;
+	int frames;
+	while (pos < end && (frames = stb_vorbis_get_samples_short_interleaved(vorb, info.channels, block, block_samples)) > 0) {
+		retval = dcaAppendInterleavedRange(dcac, block, frames, pos, start, end);
+		if (retval != DCAE_OK)
+			goto cleanup;
+		pos += frames;
+	}
+	
+	if (dcac->samples_len == 0) {
+		retval = start > 0 ? DCAE_BAD_RANGE : DCAE_READ_ERROR;
+		goto cleanup;
+	}
+	dcaFinishSamples(dcac);
+	
+cleanup:
+	stb_vorbis_close(vorb);
+	
+	return retval;
+}
+
+/*
+	--info reads the identification header from the first Ogg page and
+	the length from the granule position of the last page, without
+	setting up a decoder.
+*/
+
+//Bytes read from the end of the file to find the last page. Ogg pages are at most 65307 bytes.
+#define OGG_TAIL_BYTES	(64*1024)
+#define OGG_PAGE_HEADER_BYTES	27
+
+static uint32_t ReadLE32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+dcaError fVorbisInfo(dcaFileInfo *info, const char *fname) {
+	FILE *f = fopen(fname, "rb");
+	if (f == NULL)
+		return DCAE_READ_OPEN_ERROR;
+	
+	uint8_t buf[OGG_TAIL_BYTES];
+	dcaError retval = DCAE_READ_ERROR;
+	
+	//First page holds only the identification header
+	size_t len = fread(buf, 1, OGG_PAGE_HEADER_BYTES + 255 + 30, f);
+	if (len < OGG_PAGE_HEADER_BYTES || memcmp(buf, "OggS", 4) != 0)
+		goto cleanup;
+	uint32_t serial = ReadLE32(buf + 14);
+	size_t packet = OGG_PAGE_HEADER_BYTES + buf[26];
+	const uint8_t *ident = buf + packet;
+	if (packet + 30 > len || ident[0] != 1 || memcmp(ident + 1, "vorbis", 6) != 0)
+		goto cleanup;
+	
+	info->type = "Vorbis";
+	info->channel_cnt = ident[11];
+	info->sample_rate_hz = ReadLE32(ident + 12);
+	info->bitrate_kbps = ReadLE32(ident + 20) / 1000;
+	
+	//Find the last page of this stream that has a granule position
+	if (fseek(f, 0, SEEK_END) != 0)
+		goto cleanup;
+	long file_size = ftell(f);
+	long tail = file_size < OGG_TAIL_BYTES ? file_size : OGG_TAIL_BYTES;
+	if (fseek(f, file_size - tail, SEEK_SET) != 0)
+		goto cleanup;
+	len = fread(buf, 1, tail, f);
+	
+	for(size_t i = len >= OGG_PAGE_HEADER_BYTES ? len - OGG_PAGE_HEADER_BYTES + 1 : 0; i-- > 0; ) {
+		const uint8_t *page = buf + i;
+		if (memcmp(page, "OggS", 4) != 0 || ReadLE32(page + 14) != serial)
+			continue;
+		uint64_t granule = ReadLE32(page + 6) | (uint64_t)ReadLE32(page + 10) << 32;
+		//-1 marks a page where no packet ends
+		if (granule == UINT64_MAX)
+			continue;
+		info->samples_len = granule;
+		break;
+	}
+	retval = DCAE_OK;
 	
-	return DCAE_OK;
+cleanup:
+	fclose(f);
+	return retval;
 }
@@ -4,67 +4,183 @@
 
 #include "dr_wav.h"
 #include "dca_conv.h"
+#include "cpu.h"
 
 
-dcaError fWavLoad(DcAudioConverter *dcac, const char *fname) {
+dcaError fWavLoadMapped(DcAudioConverter *dcac, const dcaMappedFile *mf) {
 	dcaError retval = DCAE_OK;
 	drwav wav;
 	
-	if (!drwav_init_file(&wav, fname, NULL)) {
+	if (!drwav_init_memory(&wav, mf->data, mf->size, NULL))
 		return DCAE_READ_OPEN_ERROR;
-	}
 	
-	drwav_int16 *interleaved_samples = malloc(wav.totalPCMFrameCount * wav.channels * sizeof(drwav_int16));
-	size_t sample_cnt = drwav_read_pcm_frames_s16(&wav, wav.totalPCMFrameCount, interleaved_samples);
+	dcac->sample_rate_hz = wav.sampleRate;
+	
+	uint64_t start, end;
+	dcaGetRange(dcac, wav.sampleRate, &start, &end);
+	if (end > wav.totalPCMFrameCount)
+		end = wav.totalPCMFrameCount;
+	if (start > 0 && start >= end) {
+		retval = DCAE_BAD_RANGE;
+		goto cleanup;
+	}
 	
-	if (sample_cnt != wav.totalPCMFrameCount) {
-		dcaLog(LOG_WARNING, "Short read of %u samples out of %u\n", (unsigned)sample_cnt, (unsigned)wav.totalPCMFrameCount);
+	retval = dcaInitSamples(dcac, wav.channels, end - start);
+	if (retval != DCAE_OK)
+		goto cleanup;
+	if (start > 0 && !drwav_seek_to_pcm_frame(&wav, start)) {
 		retval = DCAE_READ_ERROR;
 		goto cleanup;
 	}
 	
-	dcac->sample_rate_hz = wav.sampleRate;
-	dcac->channel_cnt = wav.channels;
-	dcac->samples_len = sample_cnt;
-	dcaDeinterleaveSamples(dcac, interleaved_samples, sample_cnt, wav.channels);
+	//Convert a block at a time straight from the mapped file
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / wav.channels;
+	const size_t len = end - start;
+	while (dcac->samples_len < len) {
+		size_t want = len - dcac->samples_len < block_frames ? len - dcac->samples_len : block_frames;
+		drwav_uint64 frames = drwav_read_pcm_frames_s16(&wav, want, block);
+		if (frames == 0)
+			break;
+		retval = dcaAppendInterleaved(dcac, block, frames);
+		if (retval != DCAE_OK)
+			goto cleanup;
+	}
+	
+	if (dcac->samples_len != len) {
+		dcaLog(LOG_WARNING, "Short read of %u samples out of %u\n", (unsigned)dcac->samples_len, (unsigned)len);
+		retval = DCAE_READ_ERROR;
+		goto cleanup;
+	}
 	
-	//~ printf("Wave got %u samples and %u channels\n",(unsigned)sample_cnt, (unsigned)wav.channels);
 cleanup:
 	drwav_uninit(&wav);
-	free(interleaved_samples);
 	
 	return retval;
 }
 
-dcaError fWavWrite(DcAudioConverter *dcac, const char *outfname) {
+dcaError fWavInfo(dcaFileInfo *info, const char *fname) {
 	drwav wav;
-	drwav_data_format format;
 	
+	//Only the chunks before the sample data are read
+	if (!drwav_init_file(&wav, fname, NULL))
+		return DCAE_READ_OPEN_ERROR;
+	
+	info->type = "WAV";
+	info->channel_cnt = wav.channels;
+	info->sample_rate_hz = wav.sampleRate;
+	info->samples_len = wav.totalPCMFrameCount;
+	info->bits_per_sample = wav.bitsPerSample;
+	
+	drwav_uninit(&wav);
+	return DCAE_OK;
+}
+
+static size_t WriteToFile(void *file, const void *data, size_t bytes) {
+	return fwrite(data, 1, bytes, file);
+}
+
+/*
+	.WAV files are written a block at a time: samples are interleaved into
+	a small buffer, converted to the output sample format if it isn't
+	16-bit, and passed to dr_wav, so writing takes the same memory no
+	matter how long the sound is. The length is known up front, so the
+	header never has to be rewritten, which also lets "-" stream to
+	stdout.
+*/
+static dcaError OpenWav(drwav *wav, const char *outfname, unsigned channels, unsigned rate, size_t len, dcaWavFormat wav_format) {
+	drwav_data_format format;
 	format.container = drwav_container_riff;
-	format.format = DR_WAVE_FORMAT_PCM;
-	format.channels = dcac->channel_cnt;
-	format.sampleRate = dcac->sample_rate_hz;
-	format.bitsPerSample = 16;
+	format.format = wav_format == DCAW_FLOAT ? DR_WAVE_FORMAT_IEEE_FLOAT : DR_WAVE_FORMAT_PCM;
+	format.channels = channels;
+	format.sampleRate = rate;
+	format.bitsPerSample = wav_format == DCAW_FLOAT ? 32 : wav_format == DCAW_PCM24 ? 24 : 16;
 	
-	if (drwav_init_file_write_sequential(&wav, outfname, &format, dcac->samples_len, NULL) == 0) {
-		return DCAE_WRITE_OPEN_ERROR;
-	}
+	drwav_bool32 opened;
+	if (strcmp(outfname, "-") == 0)
+		opened = drwav_init_write_sequential_pcm_frames(wav, &format, len, WriteToFile, stdout, NULL);
+	else
+		opened = drwav_init_file_write_sequential_pcm_frames(wav, outfname, &format, len, NULL);
+	return opened ? DCAE_OK : DCAE_WRITE_OPEN_ERROR;
+}
+
+//Writes a block of interleaved 16-bit samples, converting them to the output format first
+static bool WriteBlock(drwav *wav, const int16_t *block, size_t frames, dcaWavFormat wav_format) {
+	if (wav_format == DCAW_PCM16)
+		return drwav_write_pcm_frames(wav, frames, block) == frames;
 	
-	//Interleave samples
-	int16_t *interleaved = malloc(dcac->samples_len * dcac->channel_cnt * sizeof(int16_t));
-	const unsigned ch_cnt = dcac->channel_cnt;
-	for(unsigned i = 0; i < dcac->samples_len; i++) {
-		for(unsigned c = 0; c < ch_cnt; c++) {
-			interleaved[i*ch_cnt+c] = dcac->samples[c][i];
+	size_t cnt = frames * wav->channels;
+	union {
+		float f[DCA_DECODE_BLOCK_SAMPLES];
+		uint8_t b[DCA_DECODE_BLOCK_SAMPLES * 3];
+	} converted;
+	assert(cnt <= DCA_DECODE_BLOCK_SAMPLES);
+	if (wav_format == DCAW_FLOAT) {
+		for(size_t i = 0; i < cnt; i++)
+			converted.f[i] = block[i] * (1.0f / 32768);
+	} else {
+		//24-bit samples are 3 little endian bytes, with the 16-bit sample in the top two
+		for(size_t i = 0; i < cnt; i++) {
+			converted.b[i*3] = 0;
+			converted.b[i*3 + 1] = block[i] & 0xff;
+			converted.b[i*3 + 2] = (uint16_t)block[i] >> 8;
 		}
 	}
+	return drwav_write_pcm_frames(wav, frames, &converted) == frames;
+}
+
+dcaError fWavWrite(DcAudioConverter *dcac, const char *outfname) {
+	drwav wav;
+	dcaError err = OpenWav(&wav, outfname, dcac->channel_cnt, dcac->sample_rate_hz, dcac->samples_len, dcac->wav_format);
+	if (err != DCAE_OK)
+		return err;
 	
-	//Write
-	drwav_uint64 samples_written = drwav_write_pcm_frames(&wav, dcac->samples_len, interleaved);
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / dcac->channel_cnt;
+	size_t written = 0;
+	while (written < dcac->samples_len) {
+		size_t frames = dcac->samples_len - written < block_frames ? dcac->samples_len - written : block_frames;
+		dcaCpu.interleave(block, dcac->samples, dcac->channel_cnt, written, frames);
+		if (!WriteBlock(&wav, block, frames, dcac->wav_format))
+			break;
+		written += frames;
+	}
 	
-	//Clean up
 	drwav_uninit(&wav);
-	free(interleaved);
+	return written == dcac->samples_len ? DCAE_OK : DCAE_WRITE_ERROR;
+}
+
+dcaError fWavWriteDca(const fDcAudioHeader *dca, dcaWavFormat wav_format, const char *outfname) {
+	assert(dca);
+	assert(outfname);
+	
+	unsigned channels = fDaGetChannelCount(dca);
+	size_t len = fDaGetTotalLength(dca);
+	
+	drwav wav;
+	dcaError err = OpenWav(&wav, outfname, channels, fDaCalcSampleRateHz(dca), len, wav_format);
+	if (err != DCAE_OK)
+		return err;
+	
+	//Decode a block, interleave it, and write it, so only one block of samples is ever held
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / channels & ~(size_t)1;
+	int16_t block[DCA_DECODE_BLOCK_SAMPLES];
+	int16_t decoded[DCA_DECODE_BLOCK_SAMPLES];
+	int16_t *channel_ptrs[DCA_FILE_MAX_CHANNELS];
+	for(unsigned c = 0; c < channels; c++)
+		channel_ptrs[c] = decoded + c * block_frames;
 	
-	return samples_written == dcac->samples_len ? DCAE_OK : DCAE_WRITE_ERROR;
+	fDcaDecoder dec;
+	fDcaDecoderInit(&dec, dca);
+	size_t written = 0;
+	while (written < len) {
+		size_t frames = fDcaDecode(&dec, channel_ptrs, block_frames);
+		dcaCpu.interleave(block, channel_ptrs, channels, 0, frames);
+		if (!WriteBlock(&wav, block, frames, wav_format))
+			break;
+		written += frames;
+	}
+	
+	drwav_uninit(&wav);
+	return written == len ? DCAE_OK : DCAE_WRITE_ERROR;
 }
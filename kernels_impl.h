@@ -0,0 +1,191 @@
+/*
+	Bodies of the kernels dispatched through dcaCpu.
+
+	This file is included several times by cpu.c, once per
+	instruction set, with KERNEL_ISA set to the suffix to add to each
+	function name. The code is plain C written so the compiler can
+	vectorize it for whatever target is enabled at the point of
+	inclusion. Do not include it anywhere else.
+*/
+
+#define KFN_CAT2(name, isa)	name##_##isa
+#define KFN_CAT(name, isa)	KFN_CAT2(name, isa)
+#define KFN(name)	KFN_CAT(name, KERNEL_ISA)
+
+/*
+	Channel counts are made compile time constants by calling an inline
+	helper through a switch, so the per channel loops are unrolled.
+*/
+#define KFN_CHANNEL_SWITCH(channels, call) \
+	switch (channels) { \
+	case 1: { const unsigned ch = 1; call; } break; \
+	case 2: { const unsigned ch = 2; call; } break; \
+	case 3: { const unsigned ch = 3; call; } break; \
+	case 4: { const unsigned ch = 4; call; } break; \
+	case 5: { const unsigned ch = 5; call; } break; \
+	case 6: { const unsigned ch = 6; call; } break; \
+	case 7: { const unsigned ch = 7; call; } break; \
+	case 8: { const unsigned ch = 8; call; } break; \
+	default: { const unsigned ch = channels; call; } break; \
+	}
+
+static inline void KFN(InterleaveN)(int16_t *dst, int16_t * const *src, const unsigned ch, size_t offset, size_t frames) {
+	for(unsigned c = 0; c < ch; c++) {
+		const int16_t *s = src[c] + offset;
+		for(size_t i = 0; i < frames; i++)
+			dst[i*ch + c] = s[i];
+	}
+}
+
+static void KFN(Interleave)(int16_t *dst, int16_t * const *src, unsigned channels, size_t offset, size_t frames) {
+	KFN_CHANNEL_SWITCH(channels, KFN(InterleaveN)(dst, src, ch, offset, frames));
+}
+
+static inline void KFN(DeinterleaveN)(int16_t **dst, size_t offset, const int16_t *src, const unsigned ch, size_t frames) {
+	for(unsigned c = 0; c < ch; c++) {
+		int16_t *d = dst[c] + offset;
+		for(size_t i = 0; i < frames; i++)
+			d[i] = src[i*ch + c];
+	}
+}
+
+static void KFN(Deinterleave)(int16_t **dst, size_t offset, const int16_t *src, unsigned channels, size_t frames) {
+	KFN_CHANNEL_SWITCH(channels, KFN(DeinterleaveN)(dst, offset, src, ch, frames));
+}
+
+//Averages channels together, rounding down
+static inline void KFN(DownmixN)(int16_t *dst, int16_t * const *src, const unsigned ch, size_t len) {
+	for(size_t i = 0; i < len; i++) {
+		int val = 0;
+		for(unsigned c = 0; c < ch; c++)
+			val += src[c][i];
+		//Offset to make the sum positive so the division rounds down instead of towards zero
+		dst[i] = (val + 32768 * (int)ch) / (int)ch - 32768;
+	}
+}
+
+static void KFN(Downmix)(int16_t *dst, int16_t * const *src, unsigned channels, size_t len) {
+	KFN_CHANNEL_SWITCH(channels, KFN(DownmixN)(dst, src, ch, len));
+}
+
+//Largest absolute value of any channel in [start, end)
+static inline int KFN(BlockPeak)(int16_t * const *samples, unsigned channels, size_t start, size_t end) {
+	int peak = 0;
+	for(unsigned c = 0; c < channels; c++) {
+		const int16_t *s = samples[c];
+		for(size_t i = start; i < end; i++) {
+			int v = abs(s[i]);
+			peak = v > peak ? v : peak;
+		}
+	}
+	return peak;
+}
+
+/*
+	The trim scans check the peak of whole blocks first, which
+	vectorizes, and only look at individual samples in the block that
+	contains the first loud sample.
+*/
+#define KFN_SCAN_BLOCK	256
+
+static size_t KFN(FindLoud)(int16_t * const *samples, unsigned channels, size_t start, size_t end, int threshold) {
+	for(size_t block = start; block < end; block += KFN_SCAN_BLOCK) {
+		size_t block_end = block + KFN_SCAN_BLOCK < end ? block + KFN_SCAN_BLOCK : end;
+		if (KFN(BlockPeak)(samples, channels, block, block_end) <= threshold)
+			continue;
+		for(size_t i = block; i < block_end; i++)
+			for(unsigned c = 0; c < channels; c++)
+				if (abs(samples[c][i]) > threshold)
+					return i;
+	}
+	return end;
+}
+
+static size_t KFN(FindLoudReverse)(int16_t * const *samples, unsigned channels, size_t start, size_t end, int threshold) {
+	for(size_t block_end = end; block_end > start; ) {
+		size_t block = block_end - start > KFN_SCAN_BLOCK ? block_end - KFN_SCAN_BLOCK : start;
+		if (KFN(BlockPeak)(samples, channels, block, block_end) > threshold) {
+			for(size_t i = block_end; i-- > block; )
+				for(unsigned c = 0; c < channels; c++)
+					if (abs(samples[c][i]) > threshold)
+						return i;
+		}
+		block_end = block;
+	}
+	return end;
+}
+
+static void KFN(ComplexMultiply)(dcaComplex *restrict a, const dcaComplex *restrict b, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		float re = a[i].re * b[i].re - a[i].im * b[i].im;
+		float im = a[i].re * b[i].im + a[i].im * b[i].re;
+		a[i].re = re;
+		a[i].im = im;
+	}
+}
+
+/*
+	Sums in a fixed number of independent lanes, then adds the lanes in a
+	fixed order. This vectorizes without needing reassociation, and gives
+	the same result for every instruction set.
+*/
+#define KFN_DOT_LANES	8
+
+static float KFN(Dot)(const float *restrict a, const float *restrict b, size_t n) {
+	float lanes[KFN_DOT_LANES] = {0};
+	size_t i = 0;
+	for(; i + KFN_DOT_LANES <= n; i += KFN_DOT_LANES)
+		for(unsigned l = 0; l < KFN_DOT_LANES; l++)
+			lanes[l] += a[i+l] * b[i+l];
+	for(unsigned l = 0; i < n; i++, l++)
+		lanes[l] += a[i] * b[i];
+
+	float sum = 0;
+	for(unsigned l = 0; l < KFN_DOT_LANES; l++)
+		sum += lanes[l];
+	return sum;
+}
+
+static void KFN(FftTransform)(const dcaFft *fft, dcaComplex *data, float sign) {
+	const unsigned n = fft->size;
+
+	for(unsigned i = 0; i < n; i++) {
+		unsigned r = fft->bitrev[i];
+		if (r > i) {
+			dcaComplex tmp = data[i];
+			data[i] = data[r];
+			data[r] = tmp;
+		}
+	}
+
+	//Twiddles for each pass are stored contiguously, starting with the len=2 pass
+	const dcaComplex *twiddle = fft->twiddle;
+	for(unsigned len = 2; len <= n; len <<= 1) {
+		const unsigned half = len / 2;
+		for(unsigned i = 0; i < n; i += len) {
+			dcaComplex *restrict a = data + i;
+			dcaComplex *restrict b = data + i + half;
+			for(unsigned j = 0; j < half; j++) {
+				float wre = twiddle[j].re, wim = twiddle[j].im * sign;
+				float tre = b[j].re * wre - b[j].im * wim;
+				float tim = b[j].re * wim + b[j].im * wre;
+				b[j].re = a[j].re - tre;
+				b[j].im = a[j].im - tim;
+				a[j].re += tre;
+				a[j].im += tim;
+			}
+		}
+		twiddle += half;
+	}
+}
+
+static const dcaCpuKernels KFN(kernels) = {
+	.interleave = KFN(Interleave),
+	.deinterleave = KFN(Deinterleave),
+	.downmix = KFN(Downmix),
+	.find_loud = KFN(FindLoud),
+	.find_loud_reverse = KFN(FindLoudReverse),
+	.complex_multiply = KFN(ComplexMultiply),
+	.dot = KFN(Dot),
+	.fft_transform = KFN(FftTransform),
+};
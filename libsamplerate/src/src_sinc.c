@@ -74,10 +74,7 @@ typedef struct
 } SINC_FILTER ;
 
 static SRC_ERROR sinc_multichan_vari_process (SRC_STATE *state, SRC_DATA *data) ;
-static SRC_ERROR sinc_hex_vari_process (SRC_STATE *state, SRC_DATA *data) ;
-static SRC_ERROR sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data) ;
-static SRC_ERROR sinc_stereo_vari_process (SRC_STATE *state, SRC_DATA *data) ;
-static SRC_ERROR sinc_mono_vari_process (SRC_STATE *state, SRC_DATA *data) ;
+static SRC_STATE_VT *sinc_select_vt (int converter_type, int channels) ;
 
 static SRC_ERROR prepare_data (SINC_FILTER *filter, int channels, SRC_DATA *data, int half_filter_chan_len) WARN_UNUSED ;
 
@@ -94,42 +91,6 @@ static SRC_STATE_VT sinc_multichan_state_vt =
 	sinc_close
 } ;
 
-static SRC_STATE_VT sinc_hex_state_vt =
-{
-	sinc_hex_vari_process,
-	sinc_hex_vari_process,
-	sinc_reset,
-	sinc_copy,
-	sinc_close
-} ;
-
-static SRC_STATE_VT sinc_quad_state_vt =
-{
-	sinc_quad_vari_process,
-	sinc_quad_vari_process,
-	sinc_reset,
-	sinc_copy,
-	sinc_close
-} ;
-
-static SRC_STATE_VT sinc_stereo_state_vt =
-{
-	sinc_stereo_vari_process,
-	sinc_stereo_vari_process,
-	sinc_reset,
-	sinc_copy,
-	sinc_close
-} ;
-
-static SRC_STATE_VT sinc_mono_state_vt =
-{
-	sinc_mono_vari_process,
-	sinc_mono_vari_process,
-	sinc_reset,
-	sinc_copy,
-	sinc_close
-} ;
-
 static inline increment_t
 double_to_fp (double x)
 {	return (increment_t) (psf_lrint ((x) * FP_ONE)) ;
@@ -282,16 +243,7 @@ sinc_state_new (int converter_type, int channels, SRC_ERROR *error)
 	state->channels = channels ;
 	state->mode = SRC_MODE_PROCESS ;
 
-	if (state->channels == 1)
-		state->vt = &sinc_mono_state_vt ;
-	else if (state->channels == 2)
-		state->vt = &sinc_stereo_state_vt ;
-	else if (state->channels == 4)
-		state->vt = &sinc_quad_state_vt ;
-	else if (state->channels == 6)
-		state->vt = &sinc_hex_state_vt ;
-	else
-		state->vt = &sinc_multichan_state_vt ;
+	state->vt = sinc_select_vt (converter_type, state->channels) ;
 
 	state->private_data = sinc_filter_new (converter_type, state->channels) ;
 	if (!state->private_data)
@@ -367,167 +319,34 @@ sinc_copy (SRC_STATE *state)
 **	Beware all ye who dare pass this point. There be dragons here.
 */
 
-static inline double
-calc_output_single (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index)
-{	double		fraction, left, right, icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - coeff_count ;
-
-	if (data_index < 0) /* Avoid underflow access to filter->buffer. */
-	{	int steps = -data_index ;
-		/* If the assert triggers we would have to take care not to underflow/overflow */
-		assert (steps <= int_div_ceil (filter_index, increment)) ;
-		filter_index -= increment * steps ;
-		data_index += steps ;
-	}
-	left = 0.0 ;
-	while (filter_index >= MAKE_INCREMENT_T (0))
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index < filter->b_len) ;
-		assert (data_index < filter->b_end) ;
-		left += icoeff * filter->buffer [data_index] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 1 ;
-		} ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + 1 + coeff_count ;
-
-	right = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index < filter->b_len) ;
-		assert (data_index < filter->b_end) ;
-		right += icoeff * filter->buffer [data_index] ;
-
-		filter_index -= increment ;
-		data_index = data_index - 1 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
-
-	return (left + right) ;
-} /* calc_output_single */
-
-static SRC_ERROR
-sinc_mono_vari_process (SRC_STATE *state, SRC_DATA *data)
-{	SINC_FILTER *filter ;
-	double		input_index, src_ratio, count, float_increment, terminate, rem ;
-	increment_t	increment, start_filter_index ;
-	int			half_filter_chan_len, samples_in_hand ;
-
-	if (state->private_data == NULL)
-		return SRC_ERR_NO_PRIVATE ;
-
-	filter = (SINC_FILTER*) state->private_data ;
-
-	/* If there is not a problem, this will be optimised out. */
-	if (sizeof (filter->buffer [0]) != sizeof (data->data_in [0]))
-		return SRC_ERR_SIZE_INCOMPATIBILITY ;
-
-	filter->in_count = data->input_frames * state->channels ;
-	filter->out_count = data->output_frames * state->channels ;
-	filter->in_used = filter->out_gen = 0 ;
-
-	src_ratio = state->last_ratio ;
-
-	if (is_bad_src_ratio (src_ratio))
-		return SRC_ERR_BAD_INTERNAL_STATE ;
-
-	/* Check the sample rate ratio wrt the buffer len. */
-	count = (filter->coeff_half_len + 2.0) / filter->index_inc ;
-	if (MIN (state->last_ratio, data->src_ratio) < 1.0)
-		count /= MIN (state->last_ratio, data->src_ratio) ;
-
-	/* Maximum coefficientson either side of center point. */
-	half_filter_chan_len = state->channels * (int) (psf_lrint (count) + 1) ;
-
-	input_index = state->last_position ;
-
-	rem = fmod_one (input_index) ;
-	filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-	input_index = rem ;
-
-	terminate = 1.0 / src_ratio + 1e-20 ;
-
-	/* Main processing loop. */
-	while (filter->out_gen < filter->out_count)
-	{
-		/* Need to reload buffer? */
-		samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-
-		if (samples_in_hand <= half_filter_chan_len)
-		{	if ((state->error = prepare_data (filter, state->channels, data, half_filter_chan_len)) != 0)
-				return state->error ;
-
-			samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-			if (samples_in_hand <= half_filter_chan_len)
-				break ;
-			} ;
-
-		/* This is the termination condition. */
-		if (filter->b_real_end >= 0)
-		{	if (filter->b_current + input_index + terminate > filter->b_real_end)
-				break ;
-			} ;
-
-		if (filter->out_count > 0 && fabs (state->last_ratio - data->src_ratio) > 1e-10)
-			src_ratio = state->last_ratio + filter->out_gen * (data->src_ratio - state->last_ratio) / filter->out_count ;
-
-		float_increment = filter->index_inc * (src_ratio < 1.0 ? src_ratio : 1.0) ;
-		increment = double_to_fp (float_increment) ;
-
-		start_filter_index = double_to_fp (input_index * float_increment) ;
-
-		data->data_out [filter->out_gen] = (float) ((float_increment / filter->index_inc) *
-										calc_output_single (filter, increment, start_filter_index)) ;
-		filter->out_gen ++ ;
-
-		/* Figure out the next index. */
-		input_index += 1.0 / src_ratio ;
-		rem = fmod_one (input_index) ;
-
-		filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-		input_index = rem ;
-		} ;
-
-	state->last_position = input_index ;
-
-	/* Save current ratio rather then target ratio. */
-	state->last_ratio = src_ratio ;
+/*----------------------------------------------------------------------------------------
+**	Specialised kernels.
+**
+**	The functions below are always inlined into wrappers generated by SINC_KERNEL_TIER,
+**	one per (quality tier, channel count) pair. In each wrapper the coefficient table,
+**	its length, the table increment and the channel count are compile time constants,
+**	so the channel loops are fully unrolled and the per channel accumulators live in
+**	registers. Channel counts above SINC_KERNEL_MAX_CHANNELS use the generic
+**	sinc_multichan_vari_process instead.
+*/
 
-	data->input_frames_used = filter->in_used / state->channels ;
-	data->output_frames_gen = filter->out_gen / state->channels ;
+#define SINC_KERNEL_MAX_CHANNELS	8
 
-	return SRC_ERR_NO_ERROR ;
-} /* sinc_mono_vari_process */
+#ifdef __GNUC__
+#	define SINC_ALWAYS_INLINE	inline __attribute__ ((always_inline))
+#else
+#	define SINC_ALWAYS_INLINE	inline
+#endif
 
-static inline void
-calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [2], right [2], icoeff ;
+static SINC_ALWAYS_INLINE void
+calc_output_fixed (SINC_FILTER *filter, coeff_t const *coeffs, int coeff_half_len, int channels,
+					increment_t increment, increment_t start_filter_index, double scale, float * output)
+{	double		fraction, left [SINC_KERNEL_MAX_CHANNELS], right [SINC_KERNEL_MAX_CHANNELS], icoeff ;
 	increment_t	filter_index, max_filter_index ;
 	int			data_index, coeff_count, indx ;
 
 	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
+	max_filter_index = int_to_fp (coeff_half_len) ;
 
 	/* First apply the left half of the filter. */
 	filter_index = start_filter_index ;
@@ -536,180 +355,28 @@ calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, in
 	data_index = filter->b_current - channels * coeff_count ;
 
 	if (data_index < 0) /* Avoid underflow access to filter->buffer. */
-	{	int steps = int_div_ceil (-data_index, 2) ;
+	{	int steps = int_div_ceil (-data_index, channels) ;
 		/* If the assert triggers we would have to take care not to underflow/overflow */
 		assert (steps <= int_div_ceil (filter_index, increment)) ;
 		filter_index -= increment * steps ;
-		data_index += steps * 2;
+		data_index += steps * channels ;
 	}
-	left [0] = left [1] = 0.0 ;
-	while (filter_index >= MAKE_INCREMENT_T (0))
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 1 < filter->b_len) ;
-		assert (data_index + 1 < filter->b_end) ;
-		for (int ch = 0; ch < 2; ch++)
-			left [ch] += icoeff * filter->buffer [data_index + ch] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 2 ;
-		} ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + channels * (1 + coeff_count) ;
-
-	right [0] = right [1] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 1 < filter->b_len) ;
-		assert (data_index + 1 < filter->b_end) ;
-		for (int ch = 0; ch < 2; ch++)
-			right [ch] += icoeff * filter->buffer [data_index + ch] ;
-
-		filter_index -= increment ;
-		data_index = data_index - 2 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
-
-	for (int ch = 0; ch < 2; ch++)
-		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
-} /* calc_output_stereo */
-
-SRC_ERROR
-sinc_stereo_vari_process (SRC_STATE *state, SRC_DATA *data)
-{	SINC_FILTER *filter ;
-	double		input_index, src_ratio, count, float_increment, terminate, rem ;
-	increment_t	increment, start_filter_index ;
-	int			half_filter_chan_len, samples_in_hand ;
-
-	if (state->private_data == NULL)
-		return SRC_ERR_NO_PRIVATE ;
-
-	filter = (SINC_FILTER*) state->private_data ;
-
-	/* If there is not a problem, this will be optimised out. */
-	if (sizeof (filter->buffer [0]) != sizeof (data->data_in [0]))
-		return SRC_ERR_SIZE_INCOMPATIBILITY ;
-
-	filter->in_count = data->input_frames * state->channels ;
-	filter->out_count = data->output_frames * state->channels ;
-	filter->in_used = filter->out_gen = 0 ;
-
-	src_ratio = state->last_ratio ;
-
-	if (is_bad_src_ratio (src_ratio))
-		return SRC_ERR_BAD_INTERNAL_STATE ;
-
-	/* Check the sample rate ratio wrt the buffer len. */
-	count = (filter->coeff_half_len + 2.0) / filter->index_inc ;
-	if (MIN (state->last_ratio, data->src_ratio) < 1.0)
-		count /= MIN (state->last_ratio, data->src_ratio) ;
-
-	/* Maximum coefficientson either side of center point. */
-	half_filter_chan_len = state->channels * (int) (psf_lrint (count) + 1) ;
-
-	input_index = state->last_position ;
-
-	rem = fmod_one (input_index) ;
-	filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-	input_index = rem ;
-
-	terminate = 1.0 / src_ratio + 1e-20 ;
-
-	/* Main processing loop. */
-	while (filter->out_gen < filter->out_count)
-	{
-		/* Need to reload buffer? */
-		samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-
-		if (samples_in_hand <= half_filter_chan_len)
-		{	if ((state->error = prepare_data (filter, state->channels, data, half_filter_chan_len)) != 0)
-				return state->error ;
-
-			samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-			if (samples_in_hand <= half_filter_chan_len)
-				break ;
-			} ;
-
-		/* This is the termination condition. */
-		if (filter->b_real_end >= 0)
-		{	if (filter->b_current + input_index + terminate >= filter->b_real_end)
-				break ;
-			} ;
-
-		if (filter->out_count > 0 && fabs (state->last_ratio - data->src_ratio) > 1e-10)
-			src_ratio = state->last_ratio + filter->out_gen * (data->src_ratio - state->last_ratio) / filter->out_count ;
-
-		float_increment = filter->index_inc * (src_ratio < 1.0 ? src_ratio : 1.0) ;
-		increment = double_to_fp (float_increment) ;
-
-		start_filter_index = double_to_fp (input_index * float_increment) ;
-
-		calc_output_stereo (filter, state->channels, increment, start_filter_index, float_increment / filter->index_inc, data->data_out + filter->out_gen) ;
-		filter->out_gen += 2 ;
 
-		/* Figure out the next index. */
-		input_index += 1.0 / src_ratio ;
-		rem = fmod_one (input_index) ;
-
-		filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-		input_index = rem ;
-		} ;
+	for (int ch = 0 ; ch < channels ; ch++)
+		left [ch] = 0.0 ;
 
-	state->last_position = input_index ;
-
-	/* Save current ratio rather then target ratio. */
-	state->last_ratio = src_ratio ;
-
-	data->input_frames_used = filter->in_used / state->channels ;
-	data->output_frames_gen = filter->out_gen / state->channels ;
-
-	return SRC_ERR_NO_ERROR ;
-} /* sinc_stereo_vari_process */
-
-static inline void
-calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [4], right [4], icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - channels * coeff_count ;
-
-	if (data_index < 0) /* Avoid underflow access to filter->buffer. */
-	{	int steps = int_div_ceil (-data_index, 4) ;
-		/* If the assert triggers we would have to take care not to underflow/overflow */
-		assert (steps <= int_div_ceil (filter_index, increment)) ;
-		filter_index -= increment * steps ;
-		data_index += steps * 4;
-	}
-	left [0] = left [1] = left [2] = left [3] = 0.0 ;
 	while (filter_index >= MAKE_INCREMENT_T (0))
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 3 < filter->b_len) ;
-		assert (data_index + 3 < filter->b_end) ;
-		for (int ch = 0; ch < 4; ch++)
+		assert (indx >= 0 && indx + 1 < coeff_half_len + 2) ;
+		icoeff = coeffs [indx] + fraction * (coeffs [indx + 1] - coeffs [indx]) ;
+		assert (data_index >= 0 && data_index + channels - 1 < filter->b_len) ;
+		assert (data_index + channels - 1 < filter->b_end) ;
+		for (int ch = 0 ; ch < channels ; ch++)
 			left [ch] += icoeff * filter->buffer [data_index + ch] ;
 
 		filter_index -= increment ;
-		data_index = data_index + 4 ;
+		data_index = data_index + channels ;
 		} ;
 
 	/* Now apply the right half of the filter. */
@@ -718,29 +385,30 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 	filter_index = filter_index + coeff_count * increment ;
 	data_index = filter->b_current + channels * (1 + coeff_count) ;
 
-	right [0] = right [1] = right [2] = right [3] = 0.0 ;
+	for (int ch = 0 ; ch < channels ; ch++)
+		right [ch] = 0.0 ;
+
 	do
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 3 < filter->b_len) ;
-		assert (data_index + 3 < filter->b_end) ;
-		for (int ch = 0; ch < 4; ch++)
+		assert (indx >= 0 && indx + 1 < coeff_half_len + 2) ;
+		icoeff = coeffs [indx] + fraction * (coeffs [indx + 1] - coeffs [indx]) ;
+		assert (data_index >= 0 && data_index + channels - 1 < filter->b_len) ;
+		assert (data_index + channels - 1 < filter->b_end) ;
+		for (int ch = 0 ; ch < channels ; ch++)
 			right [ch] += icoeff * filter->buffer [data_index + ch] ;
 
-
 		filter_index -= increment ;
-		data_index = data_index - 4 ;
+		data_index = data_index - channels ;
 		}
 	while (filter_index > MAKE_INCREMENT_T (0)) ;
 
-	for (int ch = 0; ch < 4; ch++)
+	for (int ch = 0 ; ch < channels ; ch++)
 		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
-} /* calc_output_quad */
+} /* calc_output_fixed */
 
-SRC_ERROR
-sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
+static SINC_ALWAYS_INLINE SRC_ERROR
+sinc_vari_process_fixed (SRC_STATE *state, SRC_DATA *data, coeff_t const *coeffs, int coeff_half_len, int index_inc, int channels)
 {	SINC_FILTER *filter ;
 	double		input_index, src_ratio, count, float_increment, terminate, rem ;
 	increment_t	increment, start_filter_index ;
@@ -755,8 +423,8 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 	if (sizeof (filter->buffer [0]) != sizeof (data->data_in [0]))
 		return SRC_ERR_SIZE_INCOMPATIBILITY ;
 
-	filter->in_count = data->input_frames * state->channels ;
-	filter->out_count = data->output_frames * state->channels ;
+	filter->in_count = data->input_frames * channels ;
+	filter->out_count = data->output_frames * channels ;
 	filter->in_used = filter->out_gen = 0 ;
 
 	src_ratio = state->last_ratio ;
@@ -765,17 +433,17 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 		return SRC_ERR_BAD_INTERNAL_STATE ;
 
 	/* Check the sample rate ratio wrt the buffer len. */
-	count = (filter->coeff_half_len + 2.0) / filter->index_inc ;
+	count = (coeff_half_len + 2.0) / index_inc ;
 	if (MIN (state->last_ratio, data->src_ratio) < 1.0)
 		count /= MIN (state->last_ratio, data->src_ratio) ;
 
 	/* Maximum coefficientson either side of center point. */
-	half_filter_chan_len = state->channels * (int) (psf_lrint (count) + 1) ;
+	half_filter_chan_len = channels * (int) (psf_lrint (count) + 1) ;
 
 	input_index = state->last_position ;
 
 	rem = fmod_one (input_index) ;
-	filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
+	filter->b_current = (filter->b_current + channels * psf_lrint (input_index - rem)) % filter->b_len ;
 	input_index = rem ;
 
 	terminate = 1.0 / src_ratio + 1e-20 ;
@@ -787,7 +455,7 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 		samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
 
 		if (samples_in_hand <= half_filter_chan_len)
-		{	if ((state->error = prepare_data (filter, state->channels, data, half_filter_chan_len)) != 0)
+		{	if ((state->error = prepare_data (filter, channels, data, half_filter_chan_len)) != 0)
 				return state->error ;
 
 			samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
@@ -795,28 +463,32 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 				break ;
 			} ;
 
-		/* This is the termination condition. */
+		/* This is the termination condition. The mono converter has always
+		** used a strict comparison here, keep it that way so output doesn't change.
+		*/
 		if (filter->b_real_end >= 0)
-		{	if (filter->b_current + input_index + terminate >= filter->b_real_end)
+		{	double end_position = filter->b_current + input_index + terminate ;
+			if (channels == 1 ? end_position > filter->b_real_end : end_position >= filter->b_real_end)
 				break ;
 			} ;
 
 		if (filter->out_count > 0 && fabs (state->last_ratio - data->src_ratio) > 1e-10)
 			src_ratio = state->last_ratio + filter->out_gen * (data->src_ratio - state->last_ratio) / filter->out_count ;
 
-		float_increment = filter->index_inc * (src_ratio < 1.0 ? src_ratio : 1.0) ;
+		float_increment = index_inc * (src_ratio < 1.0 ? src_ratio : 1.0) ;
 		increment = double_to_fp (float_increment) ;
 
 		start_filter_index = double_to_fp (input_index * float_increment) ;
 
-		calc_output_quad (filter, state->channels, increment, start_filter_index, float_increment / filter->index_inc, data->data_out + filter->out_gen) ;
-		filter->out_gen += 4 ;
+		calc_output_fixed (filter, coeffs, coeff_half_len, channels, increment, start_filter_index,
+							float_increment / index_inc, data->data_out + filter->out_gen) ;
+		filter->out_gen += channels ;
 
 		/* Figure out the next index. */
 		input_index += 1.0 / src_ratio ;
 		rem = fmod_one (input_index) ;
 
-		filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
+		filter->b_current = (filter->b_current + channels * psf_lrint (input_index - rem)) % filter->b_len ;
 		input_index = rem ;
 		} ;
 
@@ -825,166 +497,83 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 	/* Save current ratio rather then target ratio. */
 	state->last_ratio = src_ratio ;
 
-	data->input_frames_used = filter->in_used / state->channels ;
-	data->output_frames_gen = filter->out_gen / state->channels ;
+	data->input_frames_used = filter->in_used / channels ;
+	data->output_frames_gen = filter->out_gen / channels ;
 
 	return SRC_ERR_NO_ERROR ;
-} /* sinc_quad_vari_process */
-
-static inline void
-calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [6], right [6], icoeff ;
-	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
-
-	/* Convert input parameters into fixed point. */
-	max_filter_index = int_to_fp (filter->coeff_half_len) ;
-
-	/* First apply the left half of the filter. */
-	filter_index = start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current - channels * coeff_count ;
-
-	if (data_index < 0) /* Avoid underflow access to filter->buffer. */
-	{	int steps = int_div_ceil (-data_index, 6) ;
-		/* If the assert triggers we would have to take care not to underflow/overflow */
-		assert (steps <= int_div_ceil (filter_index, increment)) ;
-		filter_index -= increment * steps ;
-		data_index += steps * 6;
-	}
-	left [0] = left [1] = left [2] = left [3] = left [4] = left [5] = 0.0 ;
-	while (filter_index >= MAKE_INCREMENT_T (0))
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 5 < filter->b_len) ;
-		assert (data_index + 5 < filter->b_end) ;
-		for (int ch = 0; ch < 6; ch++)
-			left [ch] += icoeff * filter->buffer [data_index + ch] ;
-
-		filter_index -= increment ;
-		data_index = data_index + 6 ;
-		} ;
-
-	/* Now apply the right half of the filter. */
-	filter_index = increment - start_filter_index ;
-	coeff_count = (max_filter_index - filter_index) / increment ;
-	filter_index = filter_index + coeff_count * increment ;
-	data_index = filter->b_current + channels * (1 + coeff_count) ;
+} /* sinc_vari_process_fixed */
+
+/* Generates the process function and state vtable for one tier and channel count. */
+#define SINC_KERNEL(tier, table, chans) \
+	static SRC_ERROR \
+	sinc_##tier##_##chans##_vari_process (SRC_STATE *state, SRC_DATA *data) \
+	{	return sinc_vari_process_fixed (state, data, table.coeffs, ARRAY_LEN (table.coeffs) - 2, table.increment, chans) ; \
+	} \
+	static SRC_STATE_VT sinc_##tier##_##chans##_state_vt = \
+	{	sinc_##tier##_##chans##_vari_process, \
+		sinc_##tier##_##chans##_vari_process, \
+		sinc_reset, \
+		sinc_copy, \
+		sinc_close \
+	} ;
+
+/* Generates kernels for 1 to SINC_KERNEL_MAX_CHANNELS channels, and a table of them indexed by channels - 1. */
+#define SINC_KERNEL_TIER(tier, table) \
+	SINC_KERNEL (tier, table, 1) \
+	SINC_KERNEL (tier, table, 2) \
+	SINC_KERNEL (tier, table, 3) \
+	SINC_KERNEL (tier, table, 4) \
+	SINC_KERNEL (tier, table, 5) \
+	SINC_KERNEL (tier, table, 6) \
+	SINC_KERNEL (tier, table, 7) \
+	SINC_KERNEL (tier, table, 8) \
+	static SRC_STATE_VT * const sinc_##tier##_state_vts [SINC_KERNEL_MAX_CHANNELS] = \
+	{	&sinc_##tier##_1_state_vt, &sinc_##tier##_2_state_vt, \
+		&sinc_##tier##_3_state_vt, &sinc_##tier##_4_state_vt, \
+		&sinc_##tier##_5_state_vt, &sinc_##tier##_6_state_vt, \
+		&sinc_##tier##_7_state_vt, &sinc_##tier##_8_state_vt, \
+	} ;
 
-	right [0] = right [1] = right [2] = right [3] = right [4] = right [5] = 0.0 ;
-	do
-	{	fraction = fp_to_double (filter_index) ;
-		indx = fp_to_int (filter_index) ;
-		assert (indx >= 0 && indx + 1 < filter->coeff_half_len + 2) ;
-		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
-		assert (data_index >= 0 && data_index + 5 < filter->b_len) ;
-		assert (data_index + 5 < filter->b_end) ;
-		for (int ch = 0; ch < 6; ch++)
-			right [ch] += icoeff * filter->buffer [data_index + ch] ;
-
-		filter_index -= increment ;
-		data_index = data_index - 6 ;
-		}
-	while (filter_index > MAKE_INCREMENT_T (0)) ;
-
-	for (int ch = 0; ch < 6; ch++)
-		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
-} /* calc_output_hex */
-
-SRC_ERROR
-sinc_hex_vari_process (SRC_STATE *state, SRC_DATA *data)
-{	SINC_FILTER *filter ;
-	double		input_index, src_ratio, count, float_increment, terminate, rem ;
-	increment_t	increment, start_filter_index ;
-	int			half_filter_chan_len, samples_in_hand ;
-
-	if (state->private_data == NULL)
-		return SRC_ERR_NO_PRIVATE ;
-
-	filter = (SINC_FILTER*) state->private_data ;
-
-	/* If there is not a problem, this will be optimised out. */
-	if (sizeof (filter->buffer [0]) != sizeof (data->data_in [0]))
-		return SRC_ERR_SIZE_INCOMPATIBILITY ;
-
-	filter->in_count = data->input_frames * state->channels ;
-	filter->out_count = data->output_frames * state->channels ;
-	filter->in_used = filter->out_gen = 0 ;
-
-	src_ratio = state->last_ratio ;
-
-	if (is_bad_src_ratio (src_ratio))
-		return SRC_ERR_BAD_INTERNAL_STATE ;
-
-	/* Check the sample rate ratio wrt the buffer len. */
-	count = (filter->coeff_half_len + 2.0) / filter->index_inc ;
-	if (MIN (state->last_ratio, data->src_ratio) < 1.0)
-		count /= MIN (state->last_ratio, data->src_ratio) ;
-
-	/* Maximum coefficientson either side of center point. */
-	half_filter_chan_len = state->channels * (int) (psf_lrint (count) + 1) ;
-
-	input_index = state->last_position ;
-
-	rem = fmod_one (input_index) ;
-	filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-	input_index = rem ;
-
-	terminate = 1.0 / src_ratio + 1e-20 ;
-
-	/* Main processing loop. */
-	while (filter->out_gen < filter->out_count)
-	{
-		/* Need to reload buffer? */
-		samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-
-		if (samples_in_hand <= half_filter_chan_len)
-		{	if ((state->error = prepare_data (filter, state->channels, data, half_filter_chan_len)) != 0)
-				return state->error ;
-
-			samples_in_hand = (filter->b_end - filter->b_current + filter->b_len) % filter->b_len ;
-			if (samples_in_hand <= half_filter_chan_len)
-				break ;
-			} ;
-
-		/* This is the termination condition. */
-		if (filter->b_real_end >= 0)
-		{	if (filter->b_current + input_index + terminate >= filter->b_real_end)
-				break ;
-			} ;
-
-		if (filter->out_count > 0 && fabs (state->last_ratio - data->src_ratio) > 1e-10)
-			src_ratio = state->last_ratio + filter->out_gen * (data->src_ratio - state->last_ratio) / filter->out_count ;
-
-		float_increment = filter->index_inc * (src_ratio < 1.0 ? src_ratio : 1.0) ;
-		increment = double_to_fp (float_increment) ;
-
-		start_filter_index = double_to_fp (input_index * float_increment) ;
-
-		calc_output_hex (filter, state->channels, increment, start_filter_index, float_increment / filter->index_inc, data->data_out + filter->out_gen) ;
-		filter->out_gen += 6 ;
-
-		/* Figure out the next index. */
-		input_index += 1.0 / src_ratio ;
-		rem = fmod_one (input_index) ;
+#ifdef ENABLE_SINC_FAST_CONVERTER
+SINC_KERNEL_TIER (fastest, fastest_coeffs)
+#endif
+#ifdef ENABLE_SINC_MEDIUM_CONVERTER
+SINC_KERNEL_TIER (mid_qual, slow_mid_qual_coeffs)
+#endif
+#ifdef ENABLE_SINC_BEST_CONVERTER
+SINC_KERNEL_TIER (high_qual, slow_high_qual_coeffs)
+#endif
 
-		filter->b_current = (filter->b_current + state->channels * psf_lrint (input_index - rem)) % filter->b_len ;
-		input_index = rem ;
+/* Picks the kernel specialised for the converter type and channel count, if there is one. */
+static SRC_STATE_VT *
+sinc_select_vt (int converter_type, int channels)
+{
+	if (channels <= SINC_KERNEL_MAX_CHANNELS)
+	{	switch (converter_type)
+		{
+#ifdef ENABLE_SINC_FAST_CONVERTER
+		case SRC_SINC_FASTEST :
+			return sinc_fastest_state_vts [channels - 1] ;
+#endif
+#ifdef ENABLE_SINC_MEDIUM_CONVERTER
+		case SRC_SINC_MEDIUM_QUALITY :
+			return sinc_mid_qual_state_vts [channels - 1] ;
+#endif
+#ifdef ENABLE_SINC_BEST_CONVERTER
+		case SRC_SINC_BEST_QUALITY :
+			return sinc_high_qual_state_vts [channels - 1] ;
+#endif
+		default :
+			break ;
 		} ;
+	} ;
 
-	state->last_position = input_index ;
-
-	/* Save current ratio rather then target ratio. */
-	state->last_ratio = src_ratio ;
-
-	data->input_frames_used = filter->in_used / state->channels ;
-	data->output_frames_gen = filter->out_gen / state->channels ;
+	return &sinc_multichan_state_vt ;
+} /* sinc_select_vt */
 
-	return SRC_ERR_NO_ERROR ;
-} /* sinc_hex_vari_process */
+/*----------------------------------------------------------------------------------------
+**	Generic kernel for any channel count.
+*/
 
 static inline void
 calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start_filter_index, int channels, double scale, float * output)
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "dca_conv.h"
+#include "fft.h"
+#include "parallel.h"
+
+/*
+	Finds a loop start that joins cleanly onto a given loop end, for
+	--auto-loop.
+
+	When playback jumps from the loop end back to the start, what comes
+	after the start should sound like it follows what came before the end.
+	That holds when the audio leading up to the start matches the audio
+	leading up to the end, so the last LOOP_MATCH_FRAMES before the end
+	(the template) are compared against the audio before every possible
+	start. The comparison is
+
+		match = 2 * sum(t*x) / (sum(t*t) + sum(x*x))
+
+	which is 1 for identical audio, and goes down with differences in
+	either shape or level. The sums of t*x for every start are a cross
+	correlation, found with FFTs in overlapping blocks (overlap-save). Two
+	blocks go through each complex FFT, in its real and imaginary parts,
+	since correlating with a real template keeps them separate. Blocks are
+	split across threads, and each one's match is worked out as soon as
+	it's correlated, keeping only its best peaks, so the search never
+	holds more than a few blocks of the sound at a time.
+
+	The best peaks of the match are then scored on how well the spectrum
+	after the start matches the spectrum before the end, each on its own
+	thread, which catches joins that line up but change in tone.
+
+	Finally, the start is moved to where the join stays in time once the
+	sound is resampled. Loop points are scaled and truncated by
+	dcaResample, so the output loop is a whole number of samples, which is
+	usually not quite the input loop length times the ratio. Nearby starts
+	are tried to find the one whose output loop length is closest to the
+	best matching one.
+*/
+
+//Samples before the loop end that the audio before the start must match
+#define LOOP_MATCH_FRAMES	4096
+//Points in the spectra compared either side of the join
+#define LOOP_SPECTRUM_SIZE	2048
+//Bins summed into each band of those spectra, which steadies them for noisy sounds
+#define LOOP_SPECTRUM_BAND	8
+#define LOOP_BAND_CNT	(LOOP_SPECTRUM_SIZE / 2 / LOOP_SPECTRUM_BAND)
+//Peaks of the match that get their spectra compared
+#define LOOP_CANDIDATES	16
+//dB of RMS spectral difference that costs as much as the whole range of the match
+#define LOOP_SPECTRAL_DB_SCALE	400.0
+//Candidates scoring within this of the best count as equally good, and the longest loop is used
+#define LOOP_SCORE_TOLERANCE	0.01
+//Input samples either side of the best start tried when snapping, on top of one output sample's worth
+#define LOOP_SNAP_RADIUS	8
+
+//A peak of the match, with the match either side of it for finding the peak between samples
+typedef struct {
+	size_t k;
+	double match, before, after;
+} LoopCandidate;
+
+//Keeps the LOOP_CANDIDATES best peaks, best first
+static unsigned AddCandidate(LoopCandidate *cand, unsigned cnt, const LoopCandidate *c) {
+	if (cnt == LOOP_CANDIDATES && c->match <= cand[cnt - 1].match)
+		return cnt;
+	if (cnt < LOOP_CANDIDATES)
+		cnt++;
+	unsigned i = cnt - 1;
+	for(; i > 0 && cand[i - 1].match < c->match; i--)
+		cand[i] = cand[i - 1];
+	cand[i] = *c;
+	return cnt;
+}
+
+//Sample i of the sound mixed down to mono, scaled to +/-1
+static float MixAt(const DcAudioConverter *dcac, size_t i) {
+	int sum = 0;
+	for(unsigned c = 0; c < dcac->channel_cnt; c++)
+		sum += dcac->samples[c][i];
+	return sum * (1.0f / (32768.0f * dcac->channel_cnt));
+}
+
+typedef struct {
+	const DcAudioConverter *dcac;
+	unsigned window;
+	double template_energy;
+	const dcaFft *fft;
+	//Spectrum of the template, conjugated
+	const dcaComplex *template_spec;
+	//Number of starts, which begin at window
+	size_t corr_cnt;
+	size_t block_step;
+	size_t block_cnt;
+	unsigned job_cnt;
+	//Best peaks found by each job
+	LoopCandidate (*cands)[LOOP_CANDIDATES];
+	unsigned *cand_cnts;
+	bool failed;
+} CorrelateJobs;
+
+//Each block also correlates one start either side of its own, so peaks can be found at its edges
+static void LoadBlock(const CorrelateJobs *jobs, size_t block, float *dst) {
+	const size_t start = block * jobs->block_step;
+	for(unsigned i = 0; i < jobs->fft->size; i++) {
+		size_t pos = start + i;
+		dst[i*2] = pos >= 1 && pos - 1 < jobs->dcac->samples_len ? MixAt(jobs->dcac, pos - 1) : 0;
+	}
+}
+
+//Works out the match for a block's starts from its correlation in src, and adds its peaks to the job's candidates.
+//match needs room for block_step + 2 values.
+static void ScanBlock(const CorrelateJobs *jobs, size_t block, const float *src, double *match, LoopCandidate *cand, unsigned *cand_cnt) {
+	const DcAudioConverter *dcac = jobs->dcac;
+	const unsigned window = jobs->window;
+	const size_t start = block * jobs->block_step;
+	size_t end = start + jobs->block_step;
+	if (end > jobs->corr_cnt)
+		end = jobs->corr_cnt;
+	//match[k - start + 1] is for the audio before the start at k + window
+	const size_t first = start > 0 ? start - 1 : 0;
+	const size_t last = end < jobs->corr_cnt ? end + 1 : end;
+	const float scale = 1.0f / jobs->fft->size;
+	
+	double energy = 0;
+	for(unsigned i = 0; i < window; i++) {
+		float x = MixAt(dcac, first + i);
+		energy += (double)x * x;
+	}
+	for(size_t k = first; k < last; k++) {
+		if (k > first) {
+			float in = MixAt(dcac, k + window - 1), out = MixAt(dcac, k - 1);
+			energy += (double)in * in - (double)out * out;
+		}
+		double total = jobs->template_energy + (energy > 0 ? energy : 0);
+		match[k - start + 1] = 2 * src[(k - start + 1) * 2] * scale / total;
+	}
+	
+	for(size_t k = start; k < end; k++) {
+		const double *m = match + (k - start + 1);
+		bool has_before = k > 0, has_after = k + 1 < jobs->corr_cnt;
+		if ((!has_before || m[0] >= m[-1]) && (!has_after || m[0] > m[1])) {
+			LoopCandidate c = {
+				.k = k,
+				.match = m[0],
+				.before = has_before ? m[-1] : m[0],
+				.after = has_after ? m[1] : m[0],
+			};
+			*cand_cnt = AddCandidate(cand, *cand_cnt, &c);
+		}
+	}
+}
+
+static void CorrelateRange(void *ctx, unsigned job) {
+	CorrelateJobs *jobs = ctx;
+	const unsigned size = jobs->fft->size;
+	size_t first = jobs->block_cnt * job / jobs->job_cnt;
+	size_t last = jobs->block_cnt * (job + 1) / jobs->job_cnt;
+	
+	dcaComplex *work = malloc(size * sizeof(dcaComplex));
+	double *match = malloc((jobs->block_step + 2) * sizeof(double));
+	if (work == NULL || match == NULL) {
+		__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+		free(work);
+		free(match);
+		return;
+	}
+	
+	for(size_t block = first; block < last; block += 2) {
+		memset(work, 0, size * sizeof(dcaComplex));
+		LoadBlock(jobs, block, &work[0].re);
+		if (block + 1 < last)
+			LoadBlock(jobs, block + 1, &work[0].im);
+		dcaFftForward(jobs->fft, work);
+		for(unsigned k = 0; k < size; k++) {
+			dcaComplex a = work[k], t = jobs->template_spec[k];
+			work[k].re = a.re * t.re - a.im * t.im;
+			work[k].im = a.re * t.im + a.im * t.re;
+		}
+		dcaFftInverse(jobs->fft, work);
+		
+		ScanBlock(jobs, block, &work[0].re, match, jobs->cands[job], &jobs->cand_cnts[job]);
+		if (block + 1 < last)
+			ScanBlock(jobs, block + 1, &work[0].im, match, jobs->cands[job], &jobs->cand_cnts[job]);
+	}
+	
+	free(work);
+	free(match);
+}
+
+typedef struct {
+	const DcAudioConverter *dcac;
+	const dcaFft *fft;
+	const float *window;
+	//Band powers in dB of the audio before the loop end
+	const double *end_db;
+	//Bands more than 60 dB below the loudest one before the end count as that
+	double floor_db;
+	size_t starts[LOOP_CANDIDATES];
+	double spectral_db[LOOP_CANDIDATES];
+	bool failed;
+} SpectrumJobs;
+
+//Band powers in dB of LOOP_SPECTRUM_SIZE samples from start, no lower than floor_db
+static void SpectrumDb(const SpectrumJobs *jobs, size_t start, dcaComplex *work, double *dst) {
+	for(unsigned i = 0; i < LOOP_SPECTRUM_SIZE; i++) {
+		work[i].re = MixAt(jobs->dcac, start + i) * jobs->window[i];
+		work[i].im = 0;
+	}
+	dcaFftForward(jobs->fft, work);
+	for(unsigned b = 0; b < LOOP_BAND_CNT; b++) {
+		double power = 0;
+		for(unsigned k = b * LOOP_SPECTRUM_BAND; k < (b + 1) * LOOP_SPECTRUM_BAND; k++)
+			power += (double)work[k].re * work[k].re + (double)work[k].im * work[k].im;
+		double db = 10 * log10(power + 1e-20);
+		dst[b] = db > jobs->floor_db ? db : jobs->floor_db;
+	}
+}
+
+static void CompareSpectrumJob(void *ctx, unsigned i) {
+	SpectrumJobs *jobs = ctx;
+	dcaComplex *work = malloc(LOOP_SPECTRUM_SIZE * sizeof(dcaComplex));
+	double *db = malloc(LOOP_BAND_CNT * sizeof(double));
+	if (work == NULL || db == NULL) {
+		__atomic_store_n(&jobs->failed, true, __ATOMIC_RELAXED);
+		free(work);
+		free(db);
+		return;
+	}
+	
+	SpectrumDb(jobs, jobs->starts[i], work, db);
+	double sum = 0;
+	for(unsigned b = 0; b < LOOP_BAND_CNT; b++)
+		sum += (db[b] - jobs->end_db[b]) * (db[b] - jobs->end_db[b]);
+	jobs->spectral_db[i] = sqrt(sum / LOOP_BAND_CNT);
+	
+	free(work);
+	free(db);
+}
+
+//Moves start to where the loop keeps the length of the best matching one, exact_start, once resampled the way dcaResample does
+static size_t SnapStart(double exact_start, size_t min_start, size_t max_start, unsigned loop_end, float ratio, double *error) {
+	const unsigned out_end = loop_end * ratio;
+	const double want = loop_end - exact_start;
+	const size_t radius = LOOP_SNAP_RADIUS + (size_t)ceil(1 / ratio);
+	size_t center = exact_start + 0.5;
+	if (center < min_start)
+		center = min_start;
+	if (center > max_start)
+		center = max_start;
+	
+	size_t best = center;
+	double best_error = INFINITY;
+	for(size_t s = center > min_start + radius ? center - radius : min_start; s <= center + radius && s <= max_start; s++) {
+		unsigned out_start = s * ratio;
+		double err = fabs((out_end - out_start) / (double)ratio - want);
+		if (err < best_error - 1e-9 || (err < best_error + 1e-9 && fabs(s - exact_start) < fabs(best - exact_start))) {
+			best = s;
+			best_error = err;
+		}
+	}
+	*error = best_error * ratio;
+	return best;
+}
+
+dcaError dcaFindLoop(const DcAudioConverter *dcac, unsigned loop_end, unsigned min_len, unsigned out_rate_hz, dcaLoopSearch *result) {
+	assert(dcac);
+	assert(result);
+	assert(dcac->channel_cnt > 0);
+	assert(loop_end <= dcac->samples_len);
+	memset(result, 0, sizeof(*result));
+	
+	//The spectrum after the start has to fit inside the loop
+	if (min_len < LOOP_SPECTRUM_SIZE)
+		min_len = LOOP_SPECTRUM_SIZE;
+	unsigned window = LOOP_MATCH_FRAMES;
+	if (window > loop_end / 4)
+		window = loop_end / 4;
+	if (window == 0 || loop_end < window + min_len)
+		return DCAE_OK;
+	const size_t corr_cnt = loop_end - min_len - window + 1;
+	
+	dcaFft fft, spec_fft;
+	bool fft_ok = dcaFftInit(&fft, dcaFftSizeFor(window * 4));
+	bool spec_fft_ok = dcaFftInit(&spec_fft, LOOP_SPECTRUM_SIZE);
+	
+	dcaError retval = DCAE_OUT_OF_MEMORY;
+	dcaComplex *template_spec = fft_ok ? calloc(fft.size, sizeof(dcaComplex)) : NULL;
+	float *hann = malloc(LOOP_SPECTRUM_SIZE * sizeof(float));
+	double *end_db = malloc(LOOP_BAND_CNT * sizeof(double));
+	dcaComplex *work = malloc(LOOP_SPECTRUM_SIZE * sizeof(dcaComplex));
+	CorrelateJobs cjobs = {
+		.dcac = dcac,
+		.window = window,
+		.fft = &fft,
+		.template_spec = template_spec,
+		.corr_cnt = corr_cnt,
+		.failed = false,
+	};
+	if (!fft_ok || !spec_fft_ok || template_spec == NULL || hann == NULL || end_db == NULL || work == NULL)
+		goto cleanup;
+	
+	double template_energy = 0;
+	for(unsigned i = 0; i < window; i++) {
+		float x = MixAt(dcac, loop_end - window + i);
+		template_energy += (double)x * x;
+		template_spec[i].re = x;
+	}
+	//Nothing to match if the loop ends in silence
+	if (template_energy == 0) {
+		retval = DCAE_OK;
+		goto cleanup;
+	}
+	dcaFftForward(&fft, template_spec);
+	for(unsigned k = 0; k < fft.size; k++)
+		template_spec[k].im = -template_spec[k].im;
+	
+	//Blocks give fft.size - window + 1 correlations, which is two more than their step
+	cjobs.template_energy = template_energy;
+	cjobs.block_step = fft.size - window - 1;
+	cjobs.block_cnt = (corr_cnt + cjobs.block_step - 1) / cjobs.block_step;
+	//Two blocks share each FFT, so there's no point in jobs with fewer
+	cjobs.job_cnt = dcaJobThreads();
+	if (cjobs.job_cnt > (cjobs.block_cnt + 1) / 2)
+		cjobs.job_cnt = (cjobs.block_cnt + 1) / 2;
+	cjobs.cands = malloc(cjobs.job_cnt * sizeof(*cjobs.cands));
+	cjobs.cand_cnts = calloc(cjobs.job_cnt, sizeof(unsigned));
+	if (cjobs.cands == NULL || cjobs.cand_cnts == NULL)
+		goto cleanup;
+	dcaRunJobs(cjobs.job_cnt, CorrelateRange, &cjobs);
+	if (cjobs.failed)
+		goto cleanup;
+	
+	LoopCandidate cand[LOOP_CANDIDATES];
+	unsigned cand_cnt = 0;
+	for(unsigned j = 0; j < cjobs.job_cnt; j++)
+		for(unsigned i = 0; i < cjobs.cand_cnts[j]; i++)
+			cand_cnt = AddCandidate(cand, cand_cnt, &cjobs.cands[j][i]);
+	
+	for(unsigned i = 0; i < LOOP_SPECTRUM_SIZE; i++)
+		hann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / LOOP_SPECTRUM_SIZE);
+	SpectrumJobs sjobs = {
+		.dcac = dcac,
+		.fft = &spec_fft,
+		.window = hann,
+		.end_db = end_db,
+		.floor_db = -INFINITY,
+		.failed = false,
+	};
+	SpectrumDb(&sjobs, loop_end - LOOP_SPECTRUM_SIZE, work, end_db);
+	double peak_db = -INFINITY;
+	for(unsigned b = 0; b < LOOP_BAND_CNT; b++)
+		if (end_db[b] > peak_db)
+			peak_db = end_db[b];
+	sjobs.floor_db = peak_db - 60;
+	for(unsigned b = 0; b < LOOP_BAND_CNT; b++)
+		if (end_db[b] < sjobs.floor_db)
+			end_db[b] = sjobs.floor_db;
+	for(unsigned i = 0; i < cand_cnt; i++)
+		sjobs.starts[i] = cand[i].k + window;
+	dcaRunJobs(cand_cnt, CompareSpectrumJob, &sjobs);
+	if (sjobs.failed)
+		goto cleanup;
+	
+	double score[LOOP_CANDIDATES], best_score = -INFINITY;
+	for(unsigned i = 0; i < cand_cnt; i++) {
+		score[i] = cand[i].match - sjobs.spectral_db[i] / LOOP_SPECTRAL_DB_SCALE;
+		if (score[i] > best_score)
+			best_score = score[i];
+		dcaLog(LOG_INFO, "Loop start candidate %zu: match %.4f, spectra differ by %.1f dB\n",
+			sjobs.starts[i], cand[i].match, sjobs.spectral_db[i]);
+	}
+	unsigned chosen = cand_cnt;
+	for(unsigned i = 0; i < cand_cnt; i++) {
+		if (score[i] >= best_score - LOOP_SCORE_TOLERANCE && (chosen == cand_cnt || cand[i].k < cand[chosen].k))
+			chosen = i;
+	}
+	
+	//Find the peak between samples, then snap to the output rate
+	const LoopCandidate *c = &cand[chosen];
+	double offset = 0;
+	double curve = c->before - 2 * c->match + c->after;
+	if (curve < 0)
+		offset = 0.5 * (c->before - c->after) / curve;
+	float ratio = (float)out_rate_hz / dcac->sample_rate_hz;
+	result->loop_start = SnapStart(c->k + window + offset, window, corr_cnt - 1 + window, loop_end, ratio, &result->snap_error);
+	result->match = c->match;
+	result->spectral_db = sjobs.spectral_db[chosen];
+	result->found = true;
+	retval = DCAE_OK;
+	
+cleanup:
+	free(cjobs.cands);
+	free(cjobs.cand_cnts);
+	free(template_spec);
+	free(hann);
+	free(end_db);
+	free(work);
+	dcaFftFree(&fft);
+	dcaFftFree(&spec_fft);
+	return retval;
+}
@@ -2,11 +2,13 @@
 #include <string.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <math.h>
 
 #include "dca_conv.h"
 #include "dr_wav.h"
 #include "optparse.h"
-#include "samplerate.h"
+#include "cpu.h"
+#include "parallel.h"
 
 #define VERSION_STRING	"1.00"
 
@@ -20,8 +22,6 @@
 #define ARR_SIZE(array)	(sizeof(array) / sizeof(array[0]))
 #define SAFE_FREE(ptr) \
 	if (*(ptr) != NULL) { free(*(ptr)); *(ptr) = NULL; }
-#define SMART_ALLOC(ptr, size) \
-	do { SAFE_FREE(ptr); *ptr = calloc(size, 1); } while(0)
 
 void ErrorExitV(const char *fmt, va_list args) {
 	fprintf(stderr, "Error: ");
@@ -47,6 +47,19 @@ void ErrorExitOn(int cond, const char *fmt, ...) {
 	va_end(args);
 }
 
+//Room for an error message from ConvertSound and the functions it calls. They return false with a message
+//instead of exiting, since budget planning runs them on job threads.
+#define CONVERT_ERROR_SIZE	512
+
+//Formats a message for error like ErrorExit would print it, and returns false
+bool ConvertFail(char *error, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(error, CONVERT_ERROR_SIZE, fmt, args);
+	va_end(args);
+	return false;
+}
+
 //Returns a pointer to the start of the extension for a filename. If the file does not have an extension,
 //returns a pointer to a zero length string.
 const char * GetExtension(const char *name) {
@@ -59,6 +72,92 @@ const char * GetExtension(const char *name) {
 	return extension;
 }
 
+typedef enum {
+	FILE_UNKNOWN,
+	FILE_WAV,
+	FILE_DCA,
+	FILE_VORBIS,
+	FILE_FLAC,
+	FILE_MP3,
+	//Sound bank, output only
+	FILE_BANK,
+	//C source with an array for each sound, output only
+	FILE_C,
+} FileType;
+
+//Guesses a file's type from its extension
+FileType FileTypeFromName(const char *name) {
+	const char *ext = GetExtension(name);
+	if (strcasecmp(ext, ".wav") == 0)
+		return FILE_WAV;
+	else if (strcasecmp(ext, ".dca") == 0)
+		return FILE_DCA;
+	else if (strcasecmp(ext, ".ogg") == 0)
+		return FILE_VORBIS;
+	else if (strcasecmp(ext, ".flac") == 0)
+		return FILE_FLAC;
+	else if (strcasecmp(ext, ".mp3") == 0)
+		return FILE_MP3;
+	else if (strcasecmp(ext, ".dcb") == 0)
+		return FILE_BANK;
+	else if (strcasecmp(ext, ".c") == 0)
+		return FILE_C;
+	return FILE_UNKNOWN;
+}
+
+//Guesses a file's type from its first bytes, for stdin and files without a known extension
+FileType SniffFileType(const void *data, size_t size) {
+	const unsigned char *d = data;
+	if (size < 4)
+		return FILE_UNKNOWN;
+	
+	//RIFF, RIFX and RF64 Wave files, or the start of the Wave64 GUID
+	if (size >= 12 && (!memcmp(d, "RIFF", 4) || !memcmp(d, "RIFX", 4) || !memcmp(d, "RF64", 4)) && !memcmp(d + 8, "WAVE", 4))
+		return FILE_WAV;
+	if (!memcmp(d, "riff", 4))
+		return FILE_WAV;
+	if (!memcmp(d, DCA_FOURCC_STR, 4))
+		return FILE_DCA;
+	if (!memcmp(d, "fLaC", 4))
+		return FILE_FLAC;
+	if (!memcmp(d, "OggS", 4))
+		return FILE_VORBIS;
+	//MP3s start with an ID3v2 tag or a frame sync
+	if (!memcmp(d, "ID3", 3) || (d[0] == 0xff && (d[1] & 0xe0) == 0xe0))
+		return FILE_MP3;
+	return FILE_UNKNOWN;
+}
+
+//Loads a whole input file, which can be "-" for stdin. If type is FILE_UNKNOWN, it's sniffed from the data.
+dcaError LoadInput(DcAudioConverter *dcac, const char *fname, FileType type) {
+	dcaMappedFile mf;
+	dcaError retval = dcaMapFile(&mf, fname);
+	if (retval != DCAE_OK)
+		return retval;
+	
+	if (type == FILE_UNKNOWN)
+		type = SniffFileType(mf.data, mf.size);
+	
+	if (type == FILE_WAV)
+		retval = fWavLoadMapped(dcac, &mf);
+	else if (type == FILE_DCA)
+		retval = fDcaLoadMapped(dcac, &mf);
+	else if (type == FILE_VORBIS)
+		retval = fVorbisLoadMapped(dcac, &mf);
+	else if (type == FILE_FLAC)
+		retval = fFlacLoadMapped(dcac, &mf);
+	else if (type == FILE_MP3)
+		retval = fMp3LoadMapped(dcac, &mf);
+	else
+		retval = DCAE_UNSUPPORTED_FILE_TYPE;
+	
+	//Channels that point straight into the file need it to stay mapped until they're freed
+	if (dcac->borrowed_channels)
+		dcac->source = mf;
+	else
+		dcaUnmapFile(&mf);
+	return retval;
+}
 
 void dcaInit(DcAudioConverter *dcac) {
 	assert(dcac);
@@ -71,37 +170,186 @@ void dcaInit(DcAudioConverter *dcac) {
 void dcaFree(DcAudioConverter *dcac) {
 	assert(dcac);
 	for(unsigned i = 0; i < DCAC_MAX_CHANNELS; i++) {
-		SAFE_FREE(&dcac->samples[i]);
+		dcaFreeChannel(dcac, i);
 	}
+	if (dcac->source.data != NULL)
+		dcaUnmapFile(&dcac->source);
 }
 
-dcaError GeneratePreview(const char *src_fname, const char *preview_fname) {
-	if (strcasecmp(GetExtension(src_fname), ".dca") != 0) {
+//Checks that a preview can be made of the output. Previews are made by fDcaWrite from the encoded data.
+bool CanPreview(const char *out_fname, FileType out_type, const char *preview_fname) {
+	if (out_type != FILE_DCA) {
 		dcaLog(LOG_WARNING, "Can only generate previews for .DCA format output files\n");
-		return DCAE_UNSUPPORTED_FILE_TYPE;
+		return false;
+	}
+	if (strcmp(out_fname, "-") == 0) {
+		dcaLog(LOG_WARNING, "Can't generate a preview when writing to stdout\n");
+		return false;
 	}
-	if (strcasecmp(GetExtension(preview_fname), ".wav") != 0) {
+	if (FileTypeFromName(preview_fname) != FILE_WAV) {
 		dcaLog(LOG_WARNING, "Can only generate .WAV preview files\n");
-		return DCAE_UNSUPPORTED_FILE_TYPE;
+		return false;
 	}
+	return true;
+}
+
+//Reads the headers of a file to fill in info. The type comes from the extension, or the first bytes if that doesn't work.
+dcaError ProbeFile(const char *fname, dcaFileInfo *info) {
+	memset(info, 0, sizeof(*info));
+	info->format = DCAF_AUTO;
 	
-	DcAudioConverter dcac, *dcacp = &dcac;
-	dcaInit(dcacp);
-	dcaError retval = fDcaLoad(dcacp, src_fname);
+	FileType type = FileTypeFromName(fname);
+	if (type == FILE_UNKNOWN) {
+		unsigned char magic[12];
+		FILE *f = fopen(fname, "rb");
+		if (f == NULL)
+			return DCAE_READ_OPEN_ERROR;
+		size_t len = fread(magic, 1, sizeof(magic), f);
+		fclose(f);
+		type = SniffFileType(magic, len);
+	}
 	
-	if (retval) {
-		dcaLog(LOG_WARNING, "Error retrieving output file for preview (%s)\n", dcaErrorString(retval));
-	} else {
-		retval = fWavWrite(&dcac, preview_fname);
-		if (retval == DCAE_OK) {
-			dcaLog(LOG_COMPLETION, "Wrote preview to '%s'\n", preview_fname, retval);
-		} else {
-			dcaLog(LOG_WARNING, "Could not create preview of '%s' (%s)\n", src_fname, dcaErrorString(retval));
-		}
+	if (type == FILE_WAV)
+		return fWavInfo(info, fname);
+	else if (type == FILE_DCA)
+		return fDcaInfo(info, fname);
+	else if (type == FILE_VORBIS)
+		return fVorbisInfo(info, fname);
+	else if (type == FILE_FLAC)
+		return fFlacInfo(info, fname);
+	else if (type == FILE_MP3)
+		return fMp3Info(info, fname);
+	return DCAE_UNSUPPORTED_FILE_TYPE;
+}
+
+static double InfoSeconds(const dcaFileInfo *info) {
+	return info->sample_rate_hz ? (double)info->samples_len / info->sample_rate_hz : 0;
+}
+
+//Estimated size of a .DCA file made from the sound with its channels and sample rate kept, including the
+//header and the padding of each channel to 32 bytes. Files that aren't .DCA already are counted as ADPCM.
+static uint64_t InfoDcaBytes(const dcaFileInfo *info) {
+	dcaFormat format = info->format != DCAF_AUTO ? info->format : DCAF_ADPCM;
+	uint64_t channel_bytes = info->samples_len;
+	if (format == DCAF_PCM16)
+		channel_bytes *= 2;
+	else if (format == DCAF_ADPCM)
+		channel_bytes = (channel_bytes + 1) / 2;
+	channel_bytes = (channel_bytes + DCA_ALIGNMENT_MASK) & ~(uint64_t)DCA_ALIGNMENT_MASK;
+	return sizeof(fDcAudioHeader) + channel_bytes * info->channel_cnt;
+}
+
+void PrintInfoText(const char *fname, const dcaFileInfo *info) {
+	printf("%s: %s", fname, info->type);
+	if (info->format != DCAF_AUTO)
+		printf(", %s", fDaFormatString(info->format));
+	printf(", %u channel%s, %u hz", info->channel_cnt, info->channel_cnt != 1 ? "s" : "", info->sample_rate_hz);
+	if (info->bits_per_sample && info->format == DCAF_AUTO)
+		printf(", %u-bit", info->bits_per_sample);
+	if (info->bitrate_kbps)
+		printf(", %u kbps", info->bitrate_kbps);
+	if (info->samples_len)
+		printf(", %s%llu samples (%.3f seconds)", info->len_estimated ? "about " : "",
+			(unsigned long long)info->samples_len, InfoSeconds(info));
+	else
+		printf(", unknown length");
+	if (info->looping)
+		printf(", loops from %u to %u", info->loop_start, info->loop_end);
+	if (info->samples_len)
+		printf(", %s%llu bytes as %s .DCA", info->len_estimated ? "about " : "",
+			(unsigned long long)InfoDcaBytes(info), fDaFormatString(info->format != DCAF_AUTO ? info->format : DCAF_ADPCM));
+	printf("\n");
+}
+
+static void PrintJsonString(const char *str) {
+	putchar('"');
+	for(const unsigned char *c = (const unsigned char*)str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			printf("\\%c", *c);
+		else if (*c < 0x20)
+			printf("\\u%04x", *c);
+		else
+			putchar(*c);
 	}
-	dcaFree(dcacp);
+	putchar('"');
+}
+
+//Prints one element of the JSON array. If error is set, only the file name and error are printed.
+void PrintInfoJson(const char *fname, const dcaFileInfo *info, dcaError error, bool first) {
+	printf("%s\n\t{\"file\": ", first ? "" : ",");
+	PrintJsonString(fname);
+	if (error) {
+		printf(", \"error\": ");
+		PrintJsonString(dcaErrorString(error));
+		printf("}");
+		return;
+	}
+	printf(", \"type\": \"%s\", \"channels\": %u, \"sample_rate\": %u, \"samples\": %llu, \"samples_estimated\": %s, \"seconds\": %.3f, \"bits_per_sample\": %u, \"bitrate_kbps\": %u, \"estimated_dca_bytes\": %llu",
+		info->type,
+		info->channel_cnt,
+		info->sample_rate_hz,
+		(unsigned long long)info->samples_len,
+		info->len_estimated ? "true" : "false",
+		InfoSeconds(info),
+		info->bits_per_sample,
+		info->bitrate_kbps,
+		(unsigned long long)(info->samples_len ? InfoDcaBytes(info) : 0));
+	if (info->format != DCAF_AUTO)
+		printf(", \"format\": \"%s\", \"looping\": %s, \"loop_start\": %u, \"loop_end\": %u",
+			fDaFormatString(info->format),
+			info->looping ? "true" : "false",
+			info->loop_start,
+			info->loop_end);
+	printf("}");
+}
+
+//Prints information about each file without converting anything. Returns the exit code.
+int PrintInfo(const char **fnames, unsigned fname_cnt, bool json) {
+	int exit_code = 0;
 	
-	return retval;
+	if (json)
+		printf("[");
+	for(unsigned i = 0; i < fname_cnt; i++) {
+		dcaFileInfo info;
+		dcaError err = ProbeFile(fnames[i], &info);
+		if (err)
+			exit_code = 1;
+	
+		if (json)
+			PrintInfoJson(fnames[i], &info, err, i == 0);
+		else if (err)
+			dcaLog(LOG_WARNING, "%s: %s\n", fnames[i], dcaErrorString(err));
+		else
+			PrintInfoText(fnames[i], &info);
+	}
+	if (json)
+		printf("\n]\n");
+	
+	return exit_code;
+}
+
+//Parses one end of --range: a sample position, or a time if it ends with "s" or "ms". An empty string is 0.
+bool ParsePosition(const char *str, dcaPosition *pos) {
+	pos->value = 0;
+	pos->seconds = false;
+	if (str[0] == 0)
+		return true;
+	
+	char *suffix;
+	pos->value = strtod(str, &suffix);
+	if (suffix == str || !(pos->value >= 0 && pos->value < 1e15))
+		return false;
+	
+	if (strcasecmp(suffix, "s") == 0) {
+		pos->seconds = true;
+	} else if (strcasecmp(suffix, "ms") == 0) {
+		pos->seconds = true;
+		pos->value /= 1000;
+	} else if (suffix[0] != 0 || pos->value != (double)(uint64_t)pos->value) {
+		//Sample positions must be whole numbers
+		return false;
+	}
+	return true;
 }
 
 //https://cfengine.com/blog/2021/optional-arguments-with-getopt-long/
@@ -120,6 +368,49 @@ static const OptionMap out_sound_format[] = {
 	{"pcm16", DCAF_PCM16},
 	{"pcm8", DCAF_PCM8},
 	{"adpcm", DCAF_ADPCM},
+	{"auto-best", DCAF_AUTO_BEST},
+};
+
+static const OptionMap file_type[] = {
+	{"wav", FILE_WAV},
+	{"dca", FILE_DCA},
+	{"ogg", FILE_VORBIS},
+	{"vorbis", FILE_VORBIS},
+	{"flac", FILE_FLAC},
+	{"mp3", FILE_MP3},
+	{"bank", FILE_BANK},
+	{"c", FILE_C},
+};
+
+static const OptionMap cpu_level[] = {
+	{"auto", DCACPU_AUTO},
+	{"scalar", DCACPU_SCALAR},
+	{"sse2", DCACPU_SSE2},
+	{"sse4.1", DCACPU_SSE41},
+	{"avx2", DCACPU_AVX2},
+	{"avx512", DCACPU_AVX512},
+};
+
+enum {
+	INFO_NONE,
+	INFO_TEXT,
+	INFO_JSON,
+};
+static const OptionMap info_format[] = {
+	{"text", INFO_TEXT},
+	{"json", INFO_JSON},
+};
+
+static const OptionMap resampler_type[] = {
+	{"auto", DCAR_AUTO},
+	{"sinc", DCAR_SINC},
+	{"fft", DCAR_FFT},
+};
+
+static const OptionMap wav_format_type[] = {
+	{"pcm16", DCAW_PCM16},
+	{"pcm24", DCAW_PCM24},
+	{"float", DCAW_FLOAT},
 };
 
 enum {
@@ -153,6 +444,579 @@ int GetOptMap(const OptionMap *map, size_t mapsize, const char *name, int defaul
 	return default_value;
 }
 
+//Settings for ConvertSound that aren't stored in DcAudioConverter
+typedef struct {
+	int trim_threshold;
+	bool trim_silence_start;
+	bool trim_silence_end;
+	bool trim_loop_end;
+	bool loop_start_set;
+	bool loop_end_set;
+	//Pick the sample rate from the sound's bandwidth, see ChooseAutoRate
+	bool auto_rate;
+	//Energy allowed above the Nyquist frequency of the automatic rate, in dB relative to the whole sound
+	double auto_rate_threshold_db;
+	//SNR that --format auto-best aims for, and whether it can lower the sample rate to get there
+	double quality_db;
+	bool quality_rates;
+	//Search for the loop start, with loops at least this long
+	bool auto_loop;
+	double auto_loop_min_seconds;
+	//Resample looping sounds so the loop stays a whole number of samples
+	bool loop_resample;
+} ConvertOptions;
+
+//Lowest rate --rate auto picks, even for silence
+#define AUTO_RATE_MIN_HZ	4000
+
+//Frequencies listed in the --rate auto report, when they're below the source's Nyquist frequency
+static const unsigned auto_rate_report_hz[] = {2000, 4000, 6000, 8000, 11025, 16000, 22050};
+
+/*
+	For --rate auto, finds the lowest frequency that has no more than the
+	threshold of the sound's energy above it, and sets rate_hz to the lowest
+	AICA sample rate with a Nyquist frequency at or above that, up to max_hz.
+*/
+bool ChooseAutoRate(const DcAudioConverter *dcac, const ConvertOptions *opts, unsigned max_hz, unsigned *rate_hz, char *error) {
+	dcaSpectrum spec;
+	dcaError err = dcaAnalyzeSpectrum(dcac, &spec);
+	if (err)
+		return ConvertFail(error, "While analyzing bandwidth: %s\n", dcaErrorString(err));
+	
+	double max_fraction = pow(10, opts->auto_rate_threshold_db / 10);
+	double bandwidth = dcaSpectrumBandwidth(&spec, max_fraction);
+	
+	//Rates are rounded to what the AICA can play, so step up until the rounded rate is high enough
+	unsigned rate = ceil(bandwidth * 2);
+	if (rate < AUTO_RATE_MIN_HZ)
+		rate = AUTO_RATE_MIN_HZ;
+	while (rate < max_hz && fDcaToAICAFrequency(rate) < bandwidth * 2)
+		rate++;
+	//Resampling to save less than a few percent isn't worth it
+	if (rate >= max_hz - max_hz / 32)
+		rate = max_hz;
+	else
+		rate = fDcaToAICAFrequency(rate);
+	
+	for(unsigned i = 0; i < sizeof(auto_rate_report_hz) / sizeof(auto_rate_report_hz[0]); i++) {
+		if (auto_rate_report_hz[i] * 2 > dcac->sample_rate_hz)
+			break;
+		double fraction = dcaSpectrumFractionAbove(&spec, auto_rate_report_hz[i]);
+		dcaLog(LOG_INFO, "Energy above %5u hz: %6.1f dB\n", auto_rate_report_hz[i], fraction > 0 ? 10 * log10(fraction) : -INFINITY);
+	}
+	dcaLog(LOG_COMPLETION, "Bandwidth is %.0f hz (%.0f dB threshold), choosing %u hz sample rate from %u hz\n",
+		bandwidth, opts->auto_rate_threshold_db, rate, dcac->sample_rate_hz);
+	
+	dcaSpectrumFree(&spec);
+	*rate_hz = rate;
+	return true;
+}
+
+//Trims off anything after the end of the loop and fixes up any other loop problems, such as loop points
+//that rounded together when resampling
+void FixLoop(DcAudioConverter *dcac, const ConvertOptions *opts) {
+	if (opts->trim_loop_end && dcac->looping && dcac->loop_end < dcac->samples_len)
+		dcac->samples_len = dcac->loop_end;
+	if (dcac->loop_end > dcac->samples_len)
+		dcac->loop_end = dcac->samples_len;
+	if (dcac->loop_start >= dcac->loop_end) {
+		dcaLog(LOG_WARNING, "Loop start is after loop end, disabling looping\n");
+		dcac->loop_start = 0;
+		dcac->looping = false;
+	}
+}
+
+//Resamples to rate_hz, keeping the loop sample exact with --loop-resample
+bool ResampleSound(DcAudioConverter *dcac, const ConvertOptions *opts, unsigned rate_hz, FileType out_type, char *error) {
+	dcaError err = dcaResampleSound(dcac, rate_hz, opts->loop_resample, out_type == FILE_DCA);
+	if (err)
+		return ConvertFail(error, "Sample rate conversion error (%s)\n", dcaErrorString(err));
+	return true;
+}
+
+//Picks the loop start for --auto-loop, so it joins cleanly onto the loop end once resampled to out_rate_hz
+bool AutoLoop(DcAudioConverter *dcac, const ConvertOptions *opts, unsigned out_rate_hz, char *error) {
+	unsigned min_len = opts->auto_loop_min_seconds * dcac->sample_rate_hz;
+	dcaLoopSearch search;
+	dcaError err = dcaFindLoop(dcac, dcac->loop_end, min_len, out_rate_hz, &search);
+	if (err)
+		return ConvertFail(error, "While searching for a loop start: %s\n", dcaErrorString(err));
+	
+	if (!search.found) {
+		dcaLog(LOG_WARNING, "\nCouldn't find a loop start, the sound is too short for a %.1f second loop or ends in silence. Looping from %u\n",
+			opts->auto_loop_min_seconds, dcac->loop_start);
+		return true;
+	}
+	
+	dcac->loop_start = search.loop_start;
+	dcaLog(LOG_COMPLETION, "Found loop from %u to %u at %u hz: match %.4f, spectra differ by %.1f dB, join off by %.2f samples after resampling\n",
+		dcac->loop_start, dcac->loop_end, dcac->sample_rate_hz, search.match, search.spectral_db, search.snap_error);
+	return true;
+}
+
+/*
+	Resamples to a rate picked after ConvertSound, by --format auto-best or
+	a budget plan. An --auto-loop start was snapped for the rate
+	ConvertSound resampled to, so it's searched for again at the new rate,
+	unless --loop-resample kept the loop exact.
+*/
+bool ResampleToChoice(DcAudioConverter *dcac, const ConvertOptions *opts, unsigned rate_hz, char *error) {
+	if (rate_hz == dcac->sample_rate_hz)
+		return true;
+	bool exact_loop = opts->loop_resample && dcac->looping && dcac->loop_start < dcac->loop_end;
+	if (!ResampleSound(dcac, opts, rate_hz, FILE_DCA, error))
+		return false;
+	if (opts->auto_loop && dcac->looping && !exact_loop && !AutoLoop(dcac, opts, dcac->sample_rate_hz, error))
+		return false;
+	FixLoop(dcac, opts);
+	return true;
+}
+
+/*
+	For --format auto-best, trial encodes the sound in every format (and
+	at lower rates, with --quality-rates), then picks the smallest that
+	reaches the quality target. If none do, the best one is used. The
+	sound is resampled if the choice is at a lower rate.
+*/
+bool ChooseBestFormat(DcAudioConverter *dcac, const ConvertOptions *opts, char *error) {
+	dcaPlanSound plan;
+	dcaError err = dcaPlanTrials(dcac, opts->quality_rates, opts->loop_resample, &plan);
+	if (err)
+		return ConvertFail(error, "While trying encodings: %s\n", dcaErrorString(err));
+	
+	const dcaPlanChoice *best = NULL;
+	for(unsigned i = 0; i < plan.choice_cnt; i++) {
+		const dcaPlanChoice *c = &plan.choices[i];
+		bool meets = c->snr_db >= opts->quality_db;
+		if (best == NULL)
+			best = c;
+		else if (meets && (best->snr_db < opts->quality_db || c->size < best->size || (c->size == best->size && c->snr_db > best->snr_db)))
+			best = c;
+		else if (!meets && best->snr_db < opts->quality_db && c->snr_db > best->snr_db)
+			best = c;
+	}
+	
+	if (best->snr_db < opts->quality_db)
+		dcaLog(LOG_WARNING, "No format reaches %.1f dB, using the best one\n", opts->quality_db);
+	dcaLog(LOG_COMPLETION, "Chose %s at %u hz: %zu bytes, %.1f dB SNR, peak error %u\n",
+		fDaFormatString(best->format), best->sample_rate_hz, best->size, best->snr_db, best->peak_error);
+	
+	if (!ResampleToChoice(dcac, opts, best->sample_rate_hz, error))
+		return false;
+	dcac->format = best->format;
+	return true;
+}
+
+//Turns a loaded sound into what out_type needs: sets loop points, trims silence, and converts channels and sample rate.
+//Returns false with a message in error, which needs CONVERT_ERROR_SIZE bytes, if the sound can't be converted.
+bool ConvertSound(DcAudioConverter *dcac, const ConvertOptions *opts, FileType out_type, char *error) {
+	//.DCA files never go above the AICA's output rate, as below
+	if (opts->auto_rate) {
+		unsigned max_hz = dcac->sample_rate_hz;
+		if (out_type == FILE_DCA && max_hz > 44100)
+			max_hz = 44100;
+		if (!ChooseAutoRate(dcac, opts, max_hz, &dcac->desired_sample_rate_hz, error))
+			return false;
+	}
+	
+	//For .DCA, if no sample rate is specified and source sample rate is >44.1Khz, reduce output to 44.1Khz
+	//Otherwise, if no sample rate is specified, default to source file rate
+	if (out_type == FILE_DCA && dcac->desired_sample_rate_hz == 0 && dcac->sample_rate_hz > 44100)
+		dcac->desired_sample_rate_hz = 44100;
+	else if (dcac->desired_sample_rate_hz == 0)
+		dcac->desired_sample_rate_hz = dcac->sample_rate_hz;
+	
+	//Set loop end if not specified
+	if (dcac->loop_end == 0)
+		dcac->loop_end = dcac->samples_len;
+	if (dcac->loop_start >= dcac->samples_len)
+		return ConvertFail(error, "Loop start is past end of file\n");
+	if (dcac->loop_start == dcac->loop_end)
+		return ConvertFail(error, "Loop start is equal to loop end\n");
+	if (dcac->loop_start > dcac->loop_end)
+		return ConvertFail(error, "Loop start is after loop end\n");
+	if (dcac->loop_end > dcac->samples_len) {
+		dcaLog(LOG_WARNING, "\nLoop end (%u) is past end of file (%u), loop end will be set to end\n", dcac->loop_end, dcac->samples_len);
+		dcac->loop_end = dcac->samples_len;
+	}
+	
+	//Trim initial/trailing silence
+	if (opts->trim_silence_start || opts->trim_silence_end) {
+		unsigned new_start = 0, new_end = dcac->samples_len;
+		
+		//If loop points are explicitly set, do not trim past them, otherwise trim as much as possible
+		//and move the loop points in bounds
+		if (opts->trim_silence_start) {
+			unsigned max_start_trim = opts->loop_start_set ? dcac->loop_start : dcac->samples_len;
+			size_t loud = dcaCpu.find_loud(dcac->samples, dcac->channel_cnt, 0, max_start_trim, opts->trim_threshold);
+			if (loud < max_start_trim)
+				new_start = loud;
+		}
+		
+		if (opts->trim_silence_end) {
+			unsigned min_end = opts->loop_end_set ? dcac->loop_end + 1 : 1;
+			if (min_end > dcac->samples_len)
+				min_end = dcac->samples_len;
+			size_t loud = dcaCpu.find_loud_reverse(dcac->samples, dcac->channel_cnt, min_end, dcac->samples_len, opts->trim_threshold);
+			if (loud < dcac->samples_len)
+				new_end = loud;
+		}
+		//TODO think of how to handle this better
+		if (new_end < new_start)
+			new_end = new_start;
+		
+		unsigned new_len = new_end - new_start;
+		dcaLog(LOG_INFO, "Trimming results: New start: 0 -> %u, new end: %u -> %u, new len %u\n", new_start, dcac->samples_len, new_end, new_len);
+		
+		//Rebuild samples arrays with start/end removed
+		for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+			int16_t *newsamples = malloc(new_len * sizeof(int16_t));
+			memcpy(newsamples, dcac->samples[c] + new_start, new_len * sizeof(int16_t));
+			dcaFreeChannel(dcac, c);
+			dcac->samples[c] = newsamples;
+		}
+		
+		dcac->samples_len = new_len;
+		
+		//Fix up loops
+		dcac->loop_start -= new_start;
+		if (dcac->loop_start > dcac->samples_len)
+			dcac->loop_start = 0;
+		dcac->loop_end -= new_start;
+		if (dcac->loop_end > dcac->samples_len)
+			dcac->loop_end = dcac->samples_len;
+	}
+	
+	if (out_type == FILE_DCA) {
+		//TODO maybe create a few samples of silence instead of error?
+		if (dcac->samples_len == 0)
+			return ConvertFail(error, "zero length sound probably doesn't work well on AICA\n");
+		
+		//If user hasn't specified the number of channels, default to one
+		if (dcac->desired_channels == 0)
+			dcac->desired_channels = 1;
+		
+		//Default to ADPCM
+		if (dcac->format == DCAF_AUTO)
+			dcac->format = DCAF_ADPCM;
+		
+		//If we are trimming the end of the loop, use that for length instead of current length
+		unsigned len = opts->trim_loop_end ? dcac->loop_end : dcac->samples_len;
+		unsigned expected_size = (float)len * dcac->desired_sample_rate_hz / dcac->sample_rate_hz;
+		if (!dcac->long_sound && expected_size > DCAC_MAX_SAMPLES) {
+			//TODO the -64 is a hack to deal with some rounding issues when calculating sample length. find a better fix later
+			float ratio = (float)(DCAC_MAX_SAMPLES-64) / len;
+			unsigned new_rate = fDcaToAICAFrequency(dcac->sample_rate_hz * ratio);
+			unsigned desired_size_samples = (float)len * new_rate / dcac->sample_rate_hz;
+			
+			if (new_rate < DCA_MINIMUM_SAMPLE_RATE_HZ)
+				return ConvertFail(error, "This sound is too long for the AICA to handle directly.\n"
+					"To allow long sounds, use the --long option\n");
+			
+			dcaLog(LOG_WARNING, "\nInput file is long (%u samples%s). AICA only directly supports sounds shorter than %u samples.\n"
+				"Reducing frequency from %u hz to %u hz to fit within AICA limits. Resulting file will be %u samples long\n"
+				"To allow long sounds, use the --long option. Playing long sounds will require software assistance to stream samples.\n",
+				(unsigned)len,
+				opts->trim_loop_end ? " after trimming end of loop" : "",
+				(1<<16)-1,
+				dcac->sample_rate_hz,
+				new_rate,
+				desired_size_samples);
+			dcac->desired_sample_rate_hz = new_rate;
+		}
+		
+		//The floating point format of the AICA's frequency rate register results in some values getting rounded.
+		//Do the rounding here to so resampling calculations will better match actual output
+		dcac->desired_sample_rate_hz = fDcaToAICAFrequency(dcac->desired_sample_rate_hz);
+		
+		
+		if (dcac->desired_sample_rate_hz < 172) {
+			dcaLog(LOG_WARNING, "\nSample rate of %u is too low. AICA does not support sample rates less than 172 hz. Using 172 hz sample rate\n", dcac->desired_sample_rate_hz);
+			dcac->desired_sample_rate_hz = 172;
+		} else if (dcac->format == DCAF_ADPCM && dcac->desired_sample_rate_hz > DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ) {
+			dcaLog(LOG_WARNING, "\nSample rate of %u is too high for ADPCM. AICA ADPCM does not support sample rates over %u hz, reducing sample rate to %u",
+				dcac->desired_sample_rate_hz,
+				DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ,
+				DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ);
+			dcac->desired_sample_rate_hz = DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ;
+		}
+	} else if (out_type == FILE_WAV) {
+		if (dcac->desired_channels == 0)
+			dcac->desired_channels = dcac->channel_cnt;
+		
+		if (dcac->format == DCAF_AUTO || dcac->format == DCAF_AUTO_BEST)
+			dcac->format = DCAF_PCM16;
+	} else {
+		return ConvertFail(error, "Unknown output file type\n");
+	}
+	
+	//Clamp number of channels to input
+	if (dcac->desired_channels > dcac->channel_cnt) {
+		dcaLog(LOG_WARNING, "\nSpecifed number of output channels of %u is greater than number "
+			"of source file channels of %u. Output will have %u channels.\n",
+			dcac->desired_channels,
+			dcac->channel_cnt,
+			dcac->channel_cnt);
+		dcac->desired_channels = dcac->channel_cnt;
+	}
+	
+	//Handle channel conversion
+	if (dcac->desired_channels == dcac->channel_cnt) {
+		//Nothing to do in this case
+	} else if (dcac->desired_channels == 1) {
+		dcaDownmixMono(dcac);
+	} else if (dcac->desired_channels == 2 && dcac->channel_cnt == 1) {
+		return ConvertFail(error, "Converting from mono to stereo is not currently supported\n");
+	} else {
+		return ConvertFail(error, "Cannot convert from %u channel%s to %u channel%s\n",
+			dcac->channel_cnt,
+			dcac->channel_cnt > 1 ? "s" : "",
+			dcac->channel_cnt,
+			dcac->channel_cnt > 1 ? "s" : "");
+	}
+	
+	//Loops are found after downmixing, so the search hears what will be played, and before resampling, so it can allow for it
+	//With --loop-resample, the loop length doesn't need to fit the output rate
+	if (opts->auto_loop && !AutoLoop(dcac, opts, opts->loop_resample ? dcac->sample_rate_hz : dcac->desired_sample_rate_hz, error))
+		return false;
+	
+	//Adjust sample rate
+	if (dcac->desired_sample_rate_hz != dcac->sample_rate_hz && !ResampleSound(dcac, opts, dcac->desired_sample_rate_hz, out_type, error))
+		return false;
+	
+	FixLoop(dcac, opts);
+	
+	if (out_type == FILE_DCA && dcac->format == DCAF_AUTO_BEST && !ChooseBestFormat(dcac, opts, error))
+		return false;
+	
+	if (dcac->looping)
+		dcaLog(LOG_INFO, "\nFinal loop points: %u to %u\n", dcac->loop_start, dcac->loop_end);
+	return true;
+}
+
+//Name of a sound in a bank: its file name without the directory or extension
+char * BankSoundName(const char *fname) {
+	const char *base = strrchr(fname, '/');
+	base = base ? base + 1 : fname;
+	size_t len = strlen(base) - strlen(GetExtension(base));
+	char *name = malloc(len + 1);
+	memcpy(name, base, len);
+	name[len] = 0;
+	return name;
+}
+
+//Converts each input with the same settings, and packs them all into one bank or C source. If plan is
+//given, each sound is resampled and encoded the way it chose, exactly as in its trial. Returns the exit code.
+int BuildSoundSet(const DcAudioConverter *settings, const ConvertOptions *opts, const char **fnames, unsigned fname_cnt, FileType in_type,
+		const dcaPlanSound *plan, bool share_prefixes, FileType out_type, const char *out_fname) {
+	dcaBankSound *sounds = calloc(fname_cnt, sizeof(dcaBankSound));
+	
+	for(unsigned i = 0; i < fname_cnt; i++) {
+		dcaLog(LOG_INFO, "Converting '%s'\n", fnames[i]);
+		
+		//Settings don't have any samples yet, so each sound can start from a copy
+		DcAudioConverter dcac = *settings;
+		dcaError err = LoadInput(&dcac, fnames[i], in_type);
+		ErrorExitOn(err, "While loading input file '%s': %s\n", fnames[i], dcaErrorString(err));
+		
+		if (plan)
+			dcac.format = DCAF_AUTO;
+		char error[CONVERT_ERROR_SIZE];
+		ErrorExitOn(!ConvertSound(&dcac, opts, FILE_DCA, error), "While converting '%s': %s", fnames[i], error);
+		if (plan) {
+			const dcaPlanChoice *choice = &plan[i].choices[plan[i].chosen];
+			ErrorExitOn(!ResampleToChoice(&dcac, opts, choice->sample_rate_hz, error), "While converting '%s': %s", fnames[i], error);
+			dcac.format = choice->format;
+		}
+		err = fDcaEncode(&dcac, &sounds[i].image, &sounds[i].size);
+		ErrorExitOn(err, "While encoding '%s': %s\n", fnames[i], dcaErrorString(err));
+		sounds[i].name = BankSoundName(fnames[i]);
+		
+		dcaFree(&dcac);
+	}
+	
+	dcaError write_error;
+	if (out_type == FILE_BANK)
+		write_error = fBankWrite(sounds, fname_cnt, share_prefixes, out_fname);
+	else
+		write_error = fCSourceWrite(sounds, fname_cnt, out_fname);
+	if (write_error)
+		dcaLog(LOG_WARNING, "Error writing to '%s' (%s)\n", out_fname, dcaErrorString(write_error));
+	else
+		dcaLog(LOG_COMPLETION, "\nSuccessfully wrote to '%s'\n", out_fname);
+	
+	for(unsigned i = 0; i < fname_cnt; i++) {
+		free(sounds[i].image);
+		free((char*)sounds[i].name);
+	}
+	free(sounds);
+	
+	return write_error ? 1 : 0;
+}
+
+typedef struct {
+	const DcAudioConverter *settings;
+	const ConvertOptions *opts;
+	const char **fnames;
+	FileType in_type;
+	const dcaPlanCache *cache;
+	dcaPlanSound *plan;
+	uint64_t *keys;
+	bool *cached;
+	//Message from a job that failed, for the main thread to report. Empty if the job succeeded.
+	char (*errors)[CONVERT_ERROR_SIZE];
+} PlanJobs;
+
+//Sets key to a hash of a sound's file and everything that changes how it's converted, for caching its trials
+dcaError PlanCacheKey(const char *fname, const DcAudioConverter *settings, const ConvertOptions *opts, uint64_t *key) {
+	dcaMappedFile mf;
+	dcaError err = dcaMapFile(&mf, fname);
+	if (err)
+		return err;
+	
+	//Changing this string throws away old cache entries, if trials change
+	static const char version[] = "plan 3";
+	uint64_t hash = dcaHash64(version, sizeof(version), DCA_HASH64_INIT);
+	hash = dcaHash64(mf.data, mf.size, hash);
+	dcaUnmapFile(&mf);
+	
+	unsigned values[] = {
+		settings->desired_channels, settings->desired_sample_rate_hz, settings->long_sound, settings->resampler,
+		settings->looping, settings->loop_start, settings->loop_end,
+		opts->trim_threshold, opts->trim_silence_start, opts->trim_silence_end, opts->trim_loop_end,
+		opts->loop_start_set, opts->loop_end_set, opts->auto_rate, opts->auto_loop,
+		opts->loop_resample,
+	};
+	hash = dcaHash64(values, sizeof(values), hash);
+	double reals[] = {settings->range_start.value, settings->range_start.seconds, settings->range_end.value, settings->range_end.seconds,
+		opts->auto_rate_threshold_db, opts->auto_loop_min_seconds};
+	*key = dcaHash64(reals, sizeof(reals), hash);
+	return DCAE_OK;
+}
+
+//Loads and converts one sound, and trial encodes it, unless its trials are already cached
+static void PlanSoundJob(void *ctx, unsigned i) {
+	PlanJobs *jobs = ctx;
+	double priority = jobs->plan[i].priority;
+	
+	const char *fname = jobs->fnames[i];
+	char *error = jobs->errors[i];
+	
+	dcaError err = PlanCacheKey(fname, jobs->settings, jobs->opts, &jobs->keys[i]);
+	if (err) {
+		ConvertFail(error, "While loading input file '%s': %s\n", fname, dcaErrorString(err));
+		return;
+	}
+	jobs->cached[i] = dcaPlanCacheGet(jobs->cache, jobs->keys[i], &jobs->plan[i]);
+	if (!jobs->cached[i]) {
+		DcAudioConverter dcac = *jobs->settings;
+		err = LoadInput(&dcac, fname, jobs->in_type);
+		if (err) {
+			ConvertFail(error, "While loading input file '%s': %s\n", fname, dcaErrorString(err));
+			return;
+		}
+		//The trials cover every format, so auto-best doesn't need to run its own
+		dcac.format = DCAF_AUTO;
+		char convert_error[CONVERT_ERROR_SIZE];
+		if (!ConvertSound(&dcac, jobs->opts, FILE_DCA, convert_error)) {
+			ConvertFail(error, "While converting '%s': %s", fname, convert_error);
+			dcaFree(&dcac);
+			return;
+		}
+		
+		err = dcaPlanTrials(&dcac, true, jobs->opts->loop_resample, &jobs->plan[i]);
+		dcaFree(&dcac);
+		if (err) {
+			ConvertFail(error, "While trying encodings of '%s': %s\n", fname, dcaErrorString(err));
+			return;
+		}
+	}
+	jobs->plan[i].priority = priority;
+}
+
+//Picks the format and sample rate of each sound to fit them all in budget bytes of sound RAM, then prints
+//the choices, and builds a bank with them if out_fname is given. Returns the exit code.
+int PlanBudget(const DcAudioConverter *settings, const ConvertOptions *opts, const char **fnames, const double *priorities, unsigned fname_cnt,
+		FileType in_type, size_t budget, const char *cache_fname, bool share_prefixes, FileType out_type, const char *out_fname) {
+	dcaPlanCache cache = {0};
+	if (cache_fname)
+		dcaPlanCacheLoad(&cache, cache_fname);
+	
+	PlanJobs jobs = {
+		.settings = settings,
+		.opts = opts,
+		.fnames = fnames,
+		.in_type = in_type,
+		.cache = &cache,
+		.plan = calloc(fname_cnt, sizeof(dcaPlanSound)),
+		.keys = calloc(fname_cnt, sizeof(uint64_t)),
+		.cached = calloc(fname_cnt, sizeof(bool)),
+		.errors = calloc(fname_cnt, sizeof(*jobs.errors)),
+	};
+	for(unsigned i = 0; i < fname_cnt; i++)
+		jobs.plan[i].priority = priorities[i];
+	
+	dcaLog(LOG_PROGRESS, "Trying encodings of %u sound%s\n", fname_cnt, fname_cnt > 1 ? "s" : "");
+	dcaRunJobs(fname_cnt, PlanSoundJob, &jobs);
+	for(unsigned i = 0; i < fname_cnt; i++)
+		ErrorExitOn(jobs.errors[i][0] != 0, "%s", jobs.errors[i]);
+	
+	if (cache_fname) {
+		unsigned new_cnt = 0;
+		for(unsigned i = 0; i < fname_cnt; i++) {
+			if (!jobs.cached[i]) {
+				dcaPlanCachePut(&cache, jobs.keys[i], jobs.plan[i].choices, jobs.plan[i].choice_cnt);
+				new_cnt++;
+			}
+		}
+		dcaLog(LOG_INFO, "%u sound%s found in plan cache\n", fname_cnt - new_cnt, fname_cnt - new_cnt != 1 ? "s" : "");
+		if (new_cnt > 0) {
+			dcaError err = dcaPlanCacheSave(&cache, cache_fname);
+			if (err)
+				dcaLog(LOG_WARNING, "Could not write plan cache '%s' (%s)\n", cache_fname, dcaErrorString(err));
+		}
+	}
+	
+	ErrorExitOn(!dcaPlanSolve(jobs.plan, fname_cnt, budget), "The sounds don't fit in %zu bytes, even at the lowest quality\n", budget);
+	
+	size_t total = 0;
+	for(unsigned i = 0; i < fname_cnt; i++) {
+		const dcaPlanChoice *choice = &jobs.plan[i].choices[jobs.plan[i].chosen];
+		printf("%s: --format %s --rate %u (%zu bytes, %.1f dB)\n", fnames[i], fDaFormatString(choice->format),
+			choice->sample_rate_hz, choice->size, choice->snr_db);
+		total += choice->size;
+	}
+	printf("Total: %zu of %zu bytes\n", total, budget);
+	fflush(stdout);
+	
+	int exit_code = 0;
+	if (out_fname)
+		exit_code = BuildSoundSet(settings, opts, fnames, fname_cnt, in_type, jobs.plan, share_prefixes, out_type, out_fname);
+	
+	free(jobs.plan);
+	free(jobs.keys);
+	free(jobs.cached);
+	free(jobs.errors);
+	dcaPlanCacheFree(&cache);
+	return exit_code;
+}
+
+//Parses a size in bytes, which can end with K or M for kilobytes or megabytes
+bool ParseSize(const char *str, size_t *size) {
+	char *suffix;
+	double value = strtod(str, &suffix);
+	if (suffix == str || !(value > 0))
+		return false;
+	if (strcasecmp(suffix, "k") == 0)
+		value *= 1024;
+	else if (strcasecmp(suffix, "m") == 0)
+		value *= 1024*1024;
+	else if (suffix[0] != 0)
+		return false;
+	*size = value;
+	return true;
+}
+
 int main(int argc, char **argv) {
 	DcAudioConverter dcac, *dcacp = &dcac;
 	dcaInit(dcacp);
@@ -160,36 +1024,80 @@ int main(int argc, char **argv) {
 	const char *in_fname = NULL;
 	const char *out_fname = NULL;
 	const char *preview = NULL;
-	int trim_threshold = 1*256;
-	bool trim_silence_start = false;
-	bool trim_silence_end = false;
-	bool trim_loop_end = false;
-	bool loop_start_set = false;
-	bool loop_end_set = false;
+	ConvertOptions opts = {
+		.trim_threshold = 1*256,
+		.auto_rate_threshold_db = -60,
+		.quality_db = 35,
+		.auto_loop_min_seconds = 1,
+	};
+	dcaCpuLevel cpu = DCACPU_AUTO;
+	int info = INFO_NONE;
+	FileType in_type = FILE_UNKNOWN;
+	FileType out_type = FILE_UNKNOWN;
+	//Sound RAM to fit all inputs into, for --budget
+	size_t budget = 0;
+	const char *plan_cache = NULL;
+	//Let bank channels point into longer channels that start with the same data
+	bool share_prefixes = false;
+	//Every input given, for --info and banks
+	const char **in_fnames = calloc(argc, sizeof(char*));
+	unsigned in_fname_cnt = 0;
 	
 	//Parse command line parameters
 	struct optparse options;
 	int option;
 	optparse_init(&options, argv);
+	//Options with no short version
+	enum {
+		OPT_IN_FORMAT = 256,
+		OPT_OUT_FORMAT,
+		OPT_INTERLEAVE,
+		OPT_BUDGET,
+		OPT_PLAN_CACHE,
+		OPT_SHARE_PREFIXES,
+		OPT_WAV_FORMAT,
+		OPT_RATE_THRESHOLD,
+		OPT_QUALITY,
+		OPT_QUALITY_RATES,
+		OPT_AUTO_LOOP,
+		OPT_LOOP_RESAMPLE,
+	};
 	struct optparse_long longopts[] = {
 		{"help", 'h', OPTPARSE_NONE},
 		{"out", 'o', OPTPARSE_REQUIRED},
 		{"in", 'i', OPTPARSE_REQUIRED},
 		{"preview", 'p', OPTPARSE_REQUIRED},
-		
+		{"in-format", OPT_IN_FORMAT, OPTPARSE_REQUIRED},
+		{"out-format", OPT_OUT_FORMAT, OPTPARSE_REQUIRED},
+		{"info", 'I', OPTPARSE_OPTIONAL},
+	
 		{"format", 'f', OPTPARSE_REQUIRED},
 		{"rate", 'r', OPTPARSE_REQUIRED},
+		{"resampler", 'R', OPTPARSE_REQUIRED},
 		{"channels", 'c', OPTPARSE_REQUIRED},
 		{"stereo", 'S', OPTPARSE_NONE},
 		
 		{"loop", 'l', OPTPARSE_NONE},
 		{"loop-start", 's', OPTPARSE_REQUIRED},
 		{"loop-end", 'e', OPTPARSE_REQUIRED},
+		{"auto-loop", OPT_AUTO_LOOP, OPTPARSE_OPTIONAL},
+		{"loop-resample", OPT_LOOP_RESAMPLE, OPTPARSE_NONE},
 		
+		{"range", 'x', OPTPARSE_REQUIRED},
 		{"trim", 't', OPTPARSE_OPTIONAL},
 		{"long", 'L', OPTPARSE_NONE},
 		{"trim-loop-end", 'E', OPTPARSE_NONE},
+		{"interleave", OPT_INTERLEAVE, OPTPARSE_OPTIONAL},
+		{"budget", OPT_BUDGET, OPTPARSE_REQUIRED},
+		{"plan-cache", OPT_PLAN_CACHE, OPTPARSE_REQUIRED},
+		{"share-prefixes", OPT_SHARE_PREFIXES, OPTPARSE_NONE},
+		{"wav-format", OPT_WAV_FORMAT, OPTPARSE_REQUIRED},
+		{"rate-threshold", OPT_RATE_THRESHOLD, OPTPARSE_REQUIRED},
+		{"quality", OPT_QUALITY, OPTPARSE_REQUIRED},
+		{"quality-rates", OPT_QUALITY_RATES, OPTPARSE_NONE},
 		
+		{"cpu", 'C', OPTPARSE_REQUIRED},
+		{"jobs", 'j', OPTPARSE_REQUIRED},
 		{"verbose", 'v', OPTPARSE_NONE},
 		{"version", 'V', OPTPARSE_NONE},
 		{0}
@@ -203,6 +1111,11 @@ int main(int argc, char **argv) {
 			break;
 		case 'i':
 			in_fname = options.optarg;
+			in_fnames[in_fname_cnt++] = options.optarg;
+			break;
+		case 'I':
+			//The format can only be given as --info=json, so that file names after --info aren't taken as the format
+			info = GetOptMap(info_format, ARR_SIZE(info_format), options.optarg ? options.optarg : "text", -1, "invalid info format\n");
 			break;
 		case 'o':
 			out_fname = options.optarg;
@@ -210,6 +1123,12 @@ int main(int argc, char **argv) {
 		case 'p':
 			preview = options.optarg;
 			break;
+		case OPT_IN_FORMAT:
+			in_type = GetOptMap(file_type, ARR_SIZE(file_type), options.optarg, -1, "invalid input format\n");
+			break;
+		case OPT_OUT_FORMAT:
+			out_type = GetOptMap(file_type, ARR_SIZE(file_type), options.optarg, -1, "invalid output format\n");
+			break;
 		case 'f':
 			dcac.format = GetOptMap(out_sound_format, ARR_SIZE(out_sound_format), options.optarg, -1, "invalid format\n");
 			break;
@@ -224,14 +1143,14 @@ int main(int argc, char **argv) {
 			break;
 		case 's':
 			dcac.looping = true;
-			loop_start_set = true;
+			opts.loop_start_set = true;
 			if (sscanf(options.optarg, "%u", &dcac.loop_start) != 1)  {
 				ErrorExit("Invalid loop start. Must be in sample position. The first sample is 0.\n");
 			}
 			break;
 		case 'e':
 			dcac.looping = true;
-			loop_end_set = true;
+			opts.loop_end_set = true;
 			if (sscanf(options.optarg, "%u", &dcac.loop_end) != 1)  {
 				ErrorExit("Invalid loop end. Must be in sample position. The first sample is 0.\n");
 			}
@@ -243,31 +1162,96 @@ int main(int argc, char **argv) {
 			}
 			break;
 		case 'r':
+			opts.auto_rate = strcasecmp(options.optarg, "auto") == 0;
+			if (opts.auto_rate)
+				break;
 			if ((sscanf(options.optarg, "%u", &dcac.desired_sample_rate_hz) != 1) 
 					|| (dcac.desired_sample_rate_hz == 0) || (dcac.desired_sample_rate_hz > 44100))  {
 				ErrorExit("invalid sample rate, should be in the range [0, 44100]\n");
 			}
 			break;
+		case 'R':
+			dcac.resampler = GetOptMap(resampler_type, ARR_SIZE(resampler_type), options.optarg, -1, "invalid resampler\n");
+			break;
 		case 't': OPTARG_FIX_UP; {
 				if (options.optarg) {
 					int trim = GetOptMap(trim_type, ARR_SIZE(trim_type), options.optarg, -1, "invalid trim setting\n");
 					if (trim == TRIM_BOTH) {
-						trim_silence_start = true;
-						trim_silence_end = true;
+						opts.trim_silence_start = true;
+						opts.trim_silence_end = true;
 					} else if (trim == TRIM_START) {
-						trim_silence_start = true;
+						opts.trim_silence_start = true;
 					} else if (trim == TRIM_END) {
-						trim_silence_end = true;
+						opts.trim_silence_end = true;
 					} else {
 						assert(0);
 					}
 				} else {
-					trim_silence_start = true;
-					trim_silence_end = true;
+					opts.trim_silence_start = true;
+					opts.trim_silence_end = true;
 				}
 			} break;
+		case 'x': {
+				char *colon = strchr(options.optarg, ':');
+				ErrorExitOn(colon == NULL, "invalid range, should be start:end\n");
+				*colon = 0;
+				if (!ParsePosition(options.optarg, &dcac.range_start) || !ParsePosition(colon + 1, &dcac.range_end))
+					ErrorExit("invalid range. Positions are in samples, or in seconds with an \"s\" or \"ms\" suffix.\n");
+				ErrorExitOn(dcac.range_end.value != 0 && dcac.range_start.seconds == dcac.range_end.seconds
+					&& dcac.range_end.value <= dcac.range_start.value, "Range end must be after range start\n");
+			} break;
 		case 'E':
-			trim_loop_end = true;
+			opts.trim_loop_end = true;
+			break;
+		case OPT_AUTO_LOOP:
+			dcac.looping = true;
+			opts.auto_loop = true;
+			if (options.optarg && ((sscanf(options.optarg, "%lf", &opts.auto_loop_min_seconds) != 1) || !(opts.auto_loop_min_seconds >= 0)))  {
+				ErrorExit("invalid minimum loop length, should be in seconds\n");
+			}
+			break;
+		case OPT_LOOP_RESAMPLE:
+			opts.loop_resample = true;
+			break;
+		case OPT_INTERLEAVE:
+			dcac.block_size = DCAC_DEFAULT_BLOCK_SIZE;
+			if (options.optarg && ((sscanf(options.optarg, "%u", &dcac.block_size) != 1)
+					|| (dcac.block_size == 0) || (dcac.block_size % DCA_ALIGNMENT) != 0))  {
+				ErrorExit("invalid interleave block size, should be a multiple of %u bytes\n", DCA_ALIGNMENT);
+			}
+			break;
+		case OPT_BUDGET:
+			ErrorExitOn(!ParseSize(options.optarg, &budget), "invalid budget, should be a size in bytes, or with a K or M suffix\n");
+			break;
+		case OPT_PLAN_CACHE:
+			plan_cache = options.optarg;
+			break;
+		case OPT_SHARE_PREFIXES:
+			share_prefixes = true;
+			break;
+		case OPT_RATE_THRESHOLD:
+			if ((sscanf(options.optarg, "%lf", &opts.auto_rate_threshold_db) != 1) || !(opts.auto_rate_threshold_db < 0))  {
+				ErrorExit("invalid rate threshold, should be below 0 dB\n");
+			}
+			break;
+		case OPT_QUALITY:
+			if ((sscanf(options.optarg, "%lf", &opts.quality_db) != 1) || !(opts.quality_db > 0))  {
+				ErrorExit("invalid quality, should be an SNR above 0 dB\n");
+			}
+			break;
+		case OPT_QUALITY_RATES:
+			opts.quality_rates = true;
+			break;
+		case OPT_WAV_FORMAT:
+			dcac.wav_format = GetOptMap(wav_format_type, ARR_SIZE(wav_format_type), options.optarg, -1, "invalid wav format\n");
+			break;
+		case 'C':
+			cpu = GetOptMap(cpu_level, ARR_SIZE(cpu_level), options.optarg, -1, "invalid cpu level\n");
+			break;
+		case 'j':
+			if (sscanf(options.optarg, "%u", &dcaThreadCount) != 1)  {
+				ErrorExit("invalid number of jobs, should be 0 (one per CPU) or more\n");
+			}
 			break;
 		case 'v':
 			dcaCurrentLogLevel = LOG_INFO;
@@ -284,280 +1268,107 @@ int main(int argc, char **argv) {
 		}
 	}
 	
-	ErrorExitOn(in_fname == NULL, "No input file specified\n");
-	ErrorExitOn(out_fname == NULL, "No output file specified\n");
+	dcaCpuInit(cpu);
 	
-	dcaLog(LOG_INFO, "Converting '%s' to '%s'\n", in_fname, out_fname);
-	
-	const char *inext = GetExtension(in_fname);
-	const char *outext = GetExtension(out_fname);
-	ErrorExitOn(inext[0] == 0, "Unknown input file type (no extension)\n");
-	ErrorExitOn(outext[0] == 0, "Unknown output file type (no extension)\n");
-	
-	//Load input file
-	dcaError loadresult = DCAE_OK;
-	
-	if (strcasecmp(inext, ".wav") == 0) {
-		loadresult = fWavLoad(dcacp, in_fname);
-	} else if (strcasecmp(inext, ".dca") == 0) {
-		loadresult = fDcaLoad(dcacp, in_fname);
-	} else if (strcasecmp(inext, ".ogg") == 0) {
-		loadresult = fVorbisLoad(dcacp, in_fname);
-	} else if (strcasecmp(inext, ".flac") == 0) {
-		loadresult = fFlacLoad(dcacp, in_fname);
-	} else if (strcasecmp(inext, ".mp3") == 0) {
-		loadresult = fMp3Load(dcacp, in_fname);
-	} else {
-		ErrorExit("Unknown input file type\n");
-	}
-	ErrorExitOn(loadresult, "While loading input file: %s\n", dcaErrorString(loadresult));
+	//Any arguments that aren't options are more files to look at, or to put in a bank
+	const char *arg;
+	while ((arg = optparse_arg(&options)) != NULL)
+		in_fnames[in_fname_cnt++] = arg;
 	
-	assert(dcac.channel_cnt > 0);
-	assert(dcac.sample_rate_hz > 0);
-	assert(dcac.samples[0] != NULL);
+	ErrorExitOn(opts.auto_loop && opts.loop_start_set, "--auto-loop picks the loop start, so it can't be used with --loop-start\n");
 	
-	//For .DCA, if no sample rate is specified and source sample rate is >44.1Khz, reduce output to 44.1Khz
-	//Otherwise, if no sample rate is specified, default to source file rate
-	if (strcasecmp(outext, ".dca") == 0 && dcac.desired_sample_rate_hz == 0 && dcac.sample_rate_hz > 44100)
-		dcac.desired_sample_rate_hz = 44100;
-	else if (dcac.desired_sample_rate_hz == 0)
-		dcac.desired_sample_rate_hz = dcac.sample_rate_hz;
+	if (info != INFO_NONE) {
+		ErrorExitOn(in_fname_cnt == 0, "No input file specified\n");
 	
-	//Set loop end if not specified
-	if (dcac.loop_end == 0)
-		dcac.loop_end = dcac.samples_len;
-	ErrorExitOn(dcac.loop_start >= dcac.samples_len, "Loop start is past end of file\n");
-	ErrorExitOn(dcac.loop_start == dcac.loop_end, "Loop start is equal to loop end\n");
-	ErrorExitOn(dcac.loop_start > dcac.loop_end, "Loop start is after loop end\n");
-	if (dcac.loop_end > dcac.samples_len) {
-		dcaLog(LOG_WARNING, "\nLoop end (%u) is past end of file (%u), loop end will be set to end\n", dcac.loop_end, dcac.samples_len);
-		dcac.loop_end = dcac.samples_len;
+		int exit_code = PrintInfo(in_fnames, in_fname_cnt, info == INFO_JSON);
+		free(in_fnames);
+		return exit_code;
 	}
 	
-	//Trim initial/trailing silence
-	if (trim_silence_start || trim_silence_end) {
-		unsigned new_start = 0, new_end = dcac.samples_len;
+	if (out_type == FILE_UNKNOWN && out_fname != NULL)
+		out_type = FileTypeFromName(out_fname);
+	if (budget != 0) {
+		ErrorExitOn(in_fname_cnt == 0, "No input file specified\n");
+		ErrorExitOn(out_fname != NULL && out_type != FILE_BANK && out_type != FILE_C, "--budget can only be used to build banks or C source\n");
+		ErrorExitOn(preview != NULL, "Can't generate a preview of a bank or C source\n");
+		ErrorExitOn(dcac.block_size != 0 && out_type != FILE_C, "--interleave can't be used for banks\n");
 		
-		//If loop points are explicitly set, do not trim past them, otherwise trim as much as possible
-		//and move the loop points in bounds
-		if (trim_silence_start) {
-			unsigned max_start_trim = loop_start_set ? dcac.loop_start : dcac.samples_len;
-			for(unsigned i = 0; i < max_start_trim; i++) {
-				for(unsigned c = 0; c < dcac.channel_cnt; c++) {
-					if (abs(dcac.samples[c][i]) > trim_threshold) {
-						new_start = i;
-						goto exit_scan_start;
-					}
-				}
+		//Inputs can be given a priority with "file=priority". If what's after the last "=" isn't a number above 0,
+		//it's part of the file name.
+		double *priorities = malloc(in_fname_cnt * sizeof(double));
+		for(unsigned i = 0; i < in_fname_cnt; i++) {
+			priorities[i] = 1;
+			const char *eq = strrchr(in_fnames[i], '=');
+			char *end;
+			double priority;
+			if (eq != NULL && eq[1] != 0 && (priority = strtod(eq + 1, &end)) > 0 && isfinite(priority) && *end == 0) {
+				char *fname = malloc(eq - in_fnames[i] + 1);
+				memcpy(fname, in_fnames[i], eq - in_fnames[i]);
+				fname[eq - in_fnames[i]] = 0;
+				in_fnames[i] = fname;
+				priorities[i] = priority;
 			}
-		exit_scan_start:;
+			ErrorExitOn(strcmp(in_fnames[i], "-") == 0, "--budget can't read from stdin, since each input is read more than once\n");
 		}
 		
-		if (trim_silence_end) {
-			unsigned max_end_trim = loop_end_set ? dcac.loop_end : 0;
-			for(unsigned i = dcac.samples_len; i > max_end_trim; i--) {
-				for(unsigned c = 0; c < dcac.channel_cnt; c++) {
-					if (abs(dcac.samples[c][i]) > trim_threshold) {
-						new_end = i;
-						goto exit_scan_end;
-					}
-				}
-			}
-		exit_scan_end:;
-		}
-		//TODO think of how to handle this better
-		if (new_end < new_start)
-			new_end = new_start;
-		
-		unsigned new_len = new_end - new_start;
-		dcaLog(LOG_INFO, "Trimming results: New start: 0 -> %u, new end: %u -> %u, new len %u\n", new_start, dcac.samples_len, new_end, new_len);
-		
-		//Rebuild samples arrays with start/end removed
-		for(unsigned c = 0; c < dcac.channel_cnt; c++) {
-			int16_t *newsamples = malloc(new_len * sizeof(int16_t));
-			memcpy(newsamples, dcac.samples[c] + new_start, new_len * sizeof(int16_t));
-			free(dcac.samples[c]);
-			dcac.samples[c] = newsamples;
-		}
-		
-		dcac.samples_len = new_len;
-		
-		//Fix up loops
-		dcac.loop_start -= new_start;
-		if (dcac.loop_start > dcac.samples_len)
-			dcac.loop_start = 0;
-		dcac.loop_end -= new_start;
-		if (dcac.loop_end > dcac.samples_len)
-			dcac.loop_end = dcac.samples_len;
+		return PlanBudget(dcacp, &opts, in_fnames, priorities, in_fname_cnt, in_type, budget, plan_cache, share_prefixes, out_type, out_fname);
 	}
-	
-	if (strcasecmp(outext, ".dca") == 0) {
-		//TODO maybe create a few samples of silence instead of error?
-		ErrorExitOn(dcac.samples_len == 0, "zero length sound probably doesn't work well on AICA\n");
-		
-		//If user hasn't specified the number of channels, default to one
-		if (dcac.desired_channels == 0)
-			dcac.desired_channels = 1;
-		
-		//Default to ADPCM
-		if (dcac.format == DCAF_AUTO)
-			dcac.format = DCAF_ADPCM;
-		
-		//If we are trimming the end of the loop, use that for length instead of current length
-		unsigned len = trim_loop_end ? dcac.loop_end : dcac.samples_len;
-		unsigned expected_size = (float)len * dcac.desired_sample_rate_hz / dcac.sample_rate_hz;
-		if (!dcac.long_sound && expected_size > DCAC_MAX_SAMPLES) {
-			//TODO the -64 is a hack to deal with some rounding issues when calculating sample length. find a better fix later
-			float ratio = (float)(DCAC_MAX_SAMPLES-64) / len;
-			unsigned new_rate = fDcaToAICAFrequency(dcac.sample_rate_hz * ratio);
-			unsigned desired_size_samples = (float)len * new_rate / dcac.sample_rate_hz;
-			
-			ErrorExitOn(new_rate < DCA_MINIMUM_SAMPLE_RATE_HZ, "This sound is too long for the AICA to handle directly.\n"
-				"To allow long sounds, use the --long option\n");
-			
-			dcaLog(LOG_WARNING, "\nInput file is long (%u samples%s). AICA only directly supports sounds shorter than %u samples.\n"
-				"Reducing frequency from %u hz to %u hz to fit within AICA limits. Resulting file will be %u samples long\n"
-				"To allow long sounds, use the --long option. Playing long sounds will require software assistance to stream samples.\n",
-				(unsigned)len,
-				trim_loop_end ? " after trimming end of loop" : "",
-				(1<<16)-1,
-				dcac.sample_rate_hz,
-				new_rate,
-				desired_size_samples);
-			dcac.desired_sample_rate_hz = new_rate;
-		}
-		
-		//The floating point format of the AICA's frequency rate register results in some values getting rounded.
-		//Do the rounding here to so resampling calculations will better match actual output
-		dcac.desired_sample_rate_hz = fDcaToAICAFrequency(dcac.desired_sample_rate_hz);
-		
-		
-		if (dcac.desired_sample_rate_hz < 172) {
-			dcaLog(LOG_WARNING, "\nSample rate of %u is too low. AICA does not support sample rates less than 172 hz. Using 172 hz sample rate\n", dcac.desired_sample_rate_hz);
-			dcac.desired_sample_rate_hz = 172;
-		} else if (dcac.format == DCAF_ADPCM && dcac.desired_sample_rate_hz > DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ) {
-			dcaLog(LOG_WARNING, "\nSample rate of %u is too high for ADPCM. AICA ADPCM does not support sample rates over %u hz, reducing sample rate to %u",
-				dcac.desired_sample_rate_hz,
-				DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ,
-				DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ);
-			dcac.desired_sample_rate_hz = DCA_MAXIMUM_ADPCM_SAMPLE_RATE_HZ;
-		}
-	} else if (strcasecmp(outext, ".wav") == 0) {
-		if (dcac.desired_channels == 0)
-			dcac.desired_channels = dcac.channel_cnt;
+	if (out_type == FILE_BANK || out_type == FILE_C) {
+		ErrorExitOn(in_fname_cnt == 0, "No input file specified\n");
+		ErrorExitOn(preview != NULL, "Can't generate a preview of a bank or C source\n");
+		ErrorExitOn(dcac.block_size != 0 && out_type == FILE_BANK, "--interleave can't be used for banks\n");
 		
-		if (dcac.format == DCAF_AUTO)
-			dcac.format = DCAF_PCM16;
-	} else {
-		ErrorExit("Unknown output file type\n");
+		return BuildSoundSet(dcacp, &opts, in_fnames, in_fname_cnt, in_type, NULL, share_prefixes, out_type, out_fname);
 	}
 	
-	//Clamp number of channels to input
-	if (dcac.desired_channels > dcac.channel_cnt) {
-		dcaLog(LOG_WARNING, "\nSpecifed number of output channels of %u is greater than number "
-			"of source file channels of %u. Output will have %u channels.\n",
-			dcac.desired_channels,
-			dcac.channel_cnt,
-			dcac.channel_cnt);
-		dcac.desired_channels = dcac.channel_cnt;
-	}
+	ErrorExitOn(in_fname == NULL, "No input file specified\n");
+	ErrorExitOn(out_fname == NULL, "No output file specified\n");
 	
-	//Handle channel conversion
-	if (dcac.desired_channels == dcac.channel_cnt) {
-		//Nothing to do in this case
-	} else if (dcac.desired_channels == 1) {
-		dcaDownmixMono(&dcac);
-	} else if (dcac.desired_channels == 2 && dcac.channel_cnt == 1) {
-		ErrorExit("Converting from mono to stereo is not currently supported\n");
-	} else {
-		ErrorExit("Cannot convert from %u channel%s to %u channel%s\n",
-			dcac.channel_cnt,
-			dcac.channel_cnt > 1 ? "s" : "",
-			dcac.channel_cnt,
-			dcac.channel_cnt > 1 ? "s" : "");
-	}
+	dcaLog(LOG_INFO, "Converting '%s' to '%s'\n", in_fname, out_fname);
 	
-	//Adjust sample rate
-	if (dcac.desired_sample_rate_hz != dcac.sample_rate_hz) {
-		dcaLog(LOG_PROGRESS, "\nConverting input sample rate from %u hz to %u hz\n", dcac.sample_rate_hz, dcac.desired_sample_rate_hz);
-		int src_err = 0;
-		SRC_STATE *src = src_new(SRC_SINC_BEST_QUALITY, 1, &src_err);
-		assert(src);
-		ErrorExitOn(src_err, "Sample rate conversion error (%s)\n", src_strerror(src_err));
-		
-		//Allocate space to convert to float and store results
-		float ratio = (float)dcac.desired_sample_rate_hz / dcac.sample_rate_hz;
-		unsigned new_size = dcac.samples_len * ratio;
-		float *in_float = calloc(1, dcac.samples_len * sizeof(float));
-		float *out_float = calloc(1, new_size * sizeof(float));
-		
-		//Resample every channel
-		for(unsigned i = 0; i < dcac.channel_cnt; i++) {
-			//Convert to float
-			src_short_to_float_array(dcac.samples[i], in_float, dcac.samples_len);
-			
-			//Preform resampling
-			SRC_DATA srcd;
-			srcd.data_in = in_float;
-			srcd.data_out = out_float;
-			srcd.input_frames = dcac.samples_len;
-			srcd.output_frames = new_size;
-			srcd.src_ratio = (float)dcac.desired_sample_rate_hz / dcac.sample_rate_hz;
-			srcd.end_of_input = 1;
-			src_process(src, &srcd);
-			
-			//Convert to 16-bit
-			SMART_ALLOC(&dcac.samples[i], new_size * sizeof(int16_t));
-			src_float_to_short_array(out_float, dcac.samples[i], new_size);
-			
-			src_reset(src);
-		}
-		
-		free(in_float);
-		free(out_float);
-		
-		ErrorExitOn(src_err, "Sample rate conversion error (%s)\n", src_strerror(src_err));
-		
-		src_delete(src);
-		
-		dcac.sample_rate_hz = dcac.desired_sample_rate_hz;
-		dcac.samples_len = new_size;
-		//Letting it just truncate so that loop_end can't possibly go past the end
-		dcac.loop_start *= ratio;
-		dcac.loop_end *= ratio;
-	}
-	
-	//Trim off anything after the end of the loop and fix up any other loop problems
-	if (trim_loop_end && dcac.looping && dcac.loop_end < dcac.samples_len)
-		dcac.samples_len = dcac.loop_end;
-	if (dcac.loop_end > dcac.samples_len)
-		dcac.loop_end = dcac.samples_len;
-	if (dcac.loop_start >= dcac.loop_end) {
-		dcaLog(LOG_WARNING, "Loop start is after loop end, disabling looping\n");
-		dcac.loop_start = 0;
-		dcac.looping = false;
-	}
+	//Types not given with --in-format or --out-format come from the extension. If the input
+	//doesn't have a known one, such as when reading from stdin, its type is sniffed from the data.
+	if (in_type == FILE_UNKNOWN)
+		in_type = FileTypeFromName(in_fname);
+	if (out_type == FILE_UNKNOWN)
+		out_type = FileTypeFromName(out_fname);
+	ErrorExitOn(out_type == FILE_UNKNOWN, "Unknown output file type, use --out-format to set it\n");
+	ErrorExitOn(out_type != FILE_DCA && out_type != FILE_WAV, "Unsupported output file type\n");
+	ErrorExitOn(dcac.block_size != 0 && out_type != FILE_DCA, "--interleave is only for .DCA output\n");
+	
+	//Load input file
+	dcaError loadresult = LoadInput(dcacp, in_fname, in_type);
+	ErrorExitOn(loadresult, "While loading input file: %s\n", dcaErrorString(loadresult));
+	
+	assert(dcac.channel_cnt > 0);
+	assert(dcac.sample_rate_hz > 0);
+	assert(dcac.samples[0] != NULL);
+	
+	char convert_error[CONVERT_ERROR_SIZE];
+	ErrorExitOn(!ConvertSound(dcacp, &opts, out_type, convert_error), "%s", convert_error);
 	
-	if (dcac.looping)
-		dcaLog(LOG_INFO, "\nFinal loop points: %u to %u\n", dcac.loop_start, dcac.loop_end);
+	if (preview && !CanPreview(out_fname, out_type, preview))
+		preview = NULL;
 	
-	//Write output file
-	dcaError write_error = DCAE_UNKNOWN;
-	if (strcasecmp(outext, ".dca") == 0) {
-		write_error = fDcaWrite(&dcac, out_fname);
-	} else if (strcasecmp(outext, ".wav") == 0) {
+	//Write output file, and the preview with it
+	dcaError write_error = DCAE_UNKNOWN, preview_error = DCAE_UNKNOWN;
+	if (out_type == FILE_DCA) {
+		write_error = fDcaWrite(&dcac, out_fname, preview, &preview_error);
+	} else if (out_type == FILE_WAV) {
 		write_error = fWavWrite(&dcac, out_fname);
 	} else {
-		ErrorExit("Unsupported output file type '%s'\n", outext);
+		ErrorExit("Unsupported output file type\n");
 	}
 	if (write_error)
 		dcaLog(LOG_WARNING, "Error writing to '%s' (%s)\n", out_fname, dcaErrorString(write_error));
 	else
 		dcaLog(LOG_COMPLETION, "\nSuccessfully wrote to '%s'\n", out_fname);
 	
-	//Write preview
-	if (preview && !write_error) {
-		GeneratePreview(out_fname, preview);
+	if (preview) {
+		if (preview_error == DCAE_OK)
+			dcaLog(LOG_COMPLETION, "Wrote preview to '%s'\n", preview);
+		else
+			dcaLog(LOG_WARNING, "Could not create preview of '%s' (%s)\n", out_fname, dcaErrorString(preview_error));
 	}
 	
 	dcaFree(dcacp);
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "dca_conv.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DCA_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+
+/*
+	Input files are mapped into memory and given to the decoders through
+	their memory APIs, so the data goes straight from the page cache to
+	the decoder without being copied into stdio or loader buffers.
+
+	If mapping isn't possible (no mmap on this platform, or the input
+	isn't a regular file), the whole file is read into a buffer instead,
+	so loaders don't need to care which one happened. The fallback reads
+	from the descriptor that was already opened, since pipes can't be
+	opened twice.
+*/
+
+//Reads f to the end and closes it
+static dcaError ReadWholeFile(dcaMappedFile *mf, FILE *f) {
+	size_t capacity = 64*1024, size = 0;
+	unsigned char *data = malloc(capacity);
+	while (data != NULL) {
+		size += fread(data + size, 1, capacity - size, f);
+		if (size < capacity)
+			break;
+		capacity *= 2;
+		unsigned char *grown = realloc(data, capacity);
+		if (grown == NULL)
+			free(data);
+		data = grown;
+	}
+	
+	bool failed = ferror(f);
+	fclose(f);
+	
+	if (data == NULL)
+		return DCAE_OUT_OF_MEMORY;
+	if (failed) {
+		free(data);
+		return DCAE_READ_ERROR;
+	}
+	
+	mf->data = data;
+	mf->size = size;
+	mf->mapped = false;
+	return DCAE_OK;
+}
+
+dcaError dcaMapFile(dcaMappedFile *mf, const char *fname) {
+	assert(mf);
+	assert(fname);
+	memset(mf, 0, sizeof(*mf));
+	
+	//"-" is stdin. If it's redirected from a regular file, it can still be mapped.
+	bool use_stdin = strcmp(fname, "-") == 0;
+	
+#ifdef DCA_HAVE_MMAP
+	int fd = use_stdin ? dup(STDIN_FILENO) : open(fname, O_RDONLY);
+	if (fd < 0)
+		return DCAE_READ_OPEN_ERROR;
+	
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			close(fd);
+			//Decoders read front to back, so let the kernel read ahead aggressively
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			mf->data = data;
+			mf->size = st.st_size;
+			mf->mapped = true;
+			return DCAE_OK;
+		}
+	}
+	
+	FILE *f = fdopen(fd, "rb");
+	if (f == NULL) {
+		close(fd);
+		return DCAE_READ_OPEN_ERROR;
+	}
+#else
+	FILE *f = use_stdin ? stdin : fopen(fname, "rb");
+	if (f == NULL)
+		return DCAE_READ_OPEN_ERROR;
+#endif
+	
+	return ReadWholeFile(mf, f);
+}
+
+void dcaUnmapFile(dcaMappedFile *mf) {
+	assert(mf);
+	
+#ifdef DCA_HAVE_MMAP
+	if (mf->mapped)
+		munmap((void*)mf->data, mf->size);
+	else
+#endif
+		free((void*)mf->data);
+	
+	memset(mf, 0, sizeof(*mf));
+}
+
+/*
+	Outputs are written to a temporary file next to the destination, which
+	is then renamed over it. rename() replaces the name atomically, so
+	anything reading the output (such as another job in a parallel build)
+	sees either the old file or the complete new one, never a torn one,
+	and a failed conversion leaves the old file alone.
+	
+	The temporary name includes the process ID, so separate processes
+	writing the same output don't trample each other's files.
+*/
+#ifdef DCA_HAVE_MMAP
+static bool WriteAll(int fd, const unsigned char *data, size_t size) {
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+#endif
+
+dcaError dcaWriteFile(const char *fname, const void *data, size_t size) {
+	assert(fname);
+	assert(data || size == 0);
+	
+	if (strcmp(fname, "-") == 0) {
+		bool ok = fwrite(data, 1, size, stdout) == size;
+		ok &= fflush(stdout) == 0;
+		return ok ? DCAE_OK : DCAE_WRITE_ERROR;
+	}
+	
+#ifdef DCA_HAVE_MMAP
+	size_t tmp_len = strlen(fname) + 32;
+	char *tmp_name = malloc(tmp_len);
+	if (tmp_name == NULL)
+		return DCAE_OUT_OF_MEMORY;
+	snprintf(tmp_name, tmp_len, "%s.tmp%ld", fname, (long)getpid());
+	
+	int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		free(tmp_name);
+		return DCAE_WRITE_OPEN_ERROR;
+	}
+	
+	bool ok = WriteAll(fd, data, size);
+	ok &= close(fd) == 0;
+	if (ok)
+		ok = rename(tmp_name, fname) == 0;
+	if (!ok)
+		unlink(tmp_name);
+	free(tmp_name);
+	
+	return ok ? DCAE_OK : DCAE_WRITE_ERROR;
+#else
+	FILE *f = fopen(fname, "wb");
+	if (f == NULL)
+		return DCAE_WRITE_OPEN_ERROR;
+	bool ok = fwrite(data, 1, size, f) == size;
+	ok &= fclose(f) == 0;
+	return ok ? DCAE_OK : DCAE_WRITE_ERROR;
+#endif
+}
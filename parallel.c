@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "util.h"
+
+//Upper limit on threads, regardless of how many CPUs there are
+#define DCA_MAX_THREADS	64
+
+unsigned dcaThreadCount = 0;
+
+//Set on threads working through a queue, so jobs that start their own jobs run them inline
+static __thread bool in_job = false;
+
+typedef struct {
+	dcaJobFn fn;
+	void *ctx;
+	unsigned job_cnt;
+	unsigned next_job;
+} JobQueue;
+
+unsigned dcaJobThreads(void) {
+	if (in_job)
+		return 1;
+	
+	long threads = dcaThreadCount;
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > DCA_MAX_THREADS)
+		threads = DCA_MAX_THREADS;
+	return threads;
+}
+
+static void * JobWorker(void *arg) {
+	JobQueue *queue = arg;
+	in_job = true;
+	unsigned job;
+	while ((job = __atomic_fetch_add(&queue->next_job, 1, __ATOMIC_RELAXED)) < queue->job_cnt)
+		queue->fn(queue->ctx, job);
+	return NULL;
+}
+
+void dcaRunJobs(unsigned job_cnt, dcaJobFn fn, void *ctx) {
+	assert(fn);
+	
+	unsigned threads = dcaJobThreads();
+	if (threads > job_cnt)
+		threads = job_cnt;
+	
+	//Run on this thread alone. Inside a job, every thread is already busy with the outer jobs. Otherwise,
+	//there's one job or one thread, and jobs started by a lone job can still use every thread.
+	if (threads <= 1) {
+		for(unsigned job = 0; job < job_cnt; job++)
+			fn(ctx, job);
+		return;
+	}
+	
+	JobQueue queue = {
+		.fn = fn,
+		.ctx = ctx,
+		.job_cnt = job_cnt,
+		.next_job = 0,
+	};
+	
+	//The calling thread works through the queue too, so it needs one less helper
+	pthread_t helpers[DCA_MAX_THREADS];
+	unsigned started = 0;
+	for(; started + 1 < threads; started++) {
+		if (pthread_create(&helpers[started], NULL, JobWorker, &queue) != 0) {
+			dcaLog(LOG_INFO, "Could only start %u threads\n", started + 1);
+			break;
+		}
+	}
+	
+	JobWorker(&queue);
+	in_job = false;
+	
+	for(unsigned i = 0; i < started; i++)
+		pthread_join(helpers[i], NULL);
+}
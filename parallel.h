@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+	Minimal job runner for splitting work across threads.
+
+	dcaRunJobs calls fn(ctx, job) once for each job in [0, job_cnt),
+	spread across up to dcaJobThreads() threads, and returns once all of
+	them are done. Jobs may run in any order, so each one must write to
+	its own part of the output.
+	
+	Calling dcaRunJobs from inside a job runs the inner jobs one after
+	another on the calling thread, and dcaJobThreads returns 1 there.
+*/
+
+//Number of threads to use, 0 picks one per online CPU
+extern unsigned dcaThreadCount;
+
+//Returns the number of threads dcaRunJobs will use from this thread
+unsigned dcaJobThreads(void);
+
+typedef void (*dcaJobFn)(void *ctx, unsigned job);
+void dcaRunJobs(unsigned job_cnt, dcaJobFn fn, void *ctx);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "dca_conv.h"
+#include "parallel.h"
+
+/*
+	Planning for --budget: choosing the format and sample rate of each
+	sound in a set so that they all fit in a given amount of sound RAM,
+	while keeping as much quality as possible.
+
+	Each sound is trial encoded in every format at a ladder of sample
+	rates, and each result gets an estimated signal to noise ratio. The
+	noise is made up of two parts:
+
+	- What's lost by lowering the sample rate: the energy of the
+	  original above the new Nyquist frequency, from dcaAnalyzeSpectrum.
+	- What's lost by encoding: the difference between the resampled
+	  sound and its encoded and decoded version.
+
+	This avoids resampling every trial back to the original rate to
+	compare it.
+
+	--format auto-best uses the same trials for a single sound, picking
+	the smallest one that meets a quality target.
+
+	Choosing one trial per sound is a multiple-choice knapsack problem,
+	which dcaPlanSolve solves exactly with dynamic programming over the
+	budget, counted in 32 byte units (every channel is padded to that).
+*/
+
+//Rates tried below the sound's own rate, as long as they're lower
+static const unsigned plan_rates[] = {32000, 22050, 16000, 11025, 8000};
+
+//Upper limit on the table dcaPlanSolve fills in. The size unit is raised above 32 bytes to stay under it.
+#define PLAN_MAX_CELLS	(64*1024*1024)
+
+//Mean of the squared samples across all channels
+static double MeanPower(const DcAudioConverter *dcac) {
+	double sum = 0;
+	for(unsigned c = 0; c < dcac->channel_cnt; c++)
+		for(size_t i = 0; i < dcac->samples_len; i++)
+			sum += (double)dcac->samples[c][i] * dcac->samples[c][i];
+	return sum / ((double)dcac->samples_len * dcac->channel_cnt);
+}
+
+//Makes a copy of a sound's samples and settings, which owns its samples
+static dcaError CopySound(DcAudioConverter *dst, const DcAudioConverter *src) {
+	*dst = *src;
+	dst->borrowed_channels = 0;
+	memset(&dst->source, 0, sizeof(dst->source));
+	for(unsigned c = 0; c < src->channel_cnt; c++) {
+		dst->samples[c] = malloc(src->samples_len * sizeof(int16_t));
+		if (dst->samples[c] == NULL) {
+			for(unsigned i = 0; i < c; i++)
+				free(dst->samples[i]);
+			return DCAE_OUT_OF_MEMORY;
+		}
+		memcpy(dst->samples[c], src->samples[c], src->samples_len * sizeof(int16_t));
+	}
+	return DCAE_OK;
+}
+
+static const dcaFormat trial_formats[] = {DCAF_PCM16, DCAF_PCM8, DCAF_ADPCM};
+#define TRIAL_FORMAT_CNT	(sizeof(trial_formats) / sizeof(trial_formats[0]))
+
+/*
+	The formats at one rate are tried at the same time, each as its own
+	job. Each job only holds its encoded file, and decodes it a block at
+	a time to compare it, so memory stays at one copy of the sound plus
+	one encoded file per format, no matter how long the sound is.
+*/
+typedef struct {
+	const DcAudioConverter *sound;
+	size_t size[TRIAL_FORMAT_CNT];
+	double noise_power[TRIAL_FORMAT_CNT];
+	int peak_error[TRIAL_FORMAT_CNT];
+	dcaError err[TRIAL_FORMAT_CNT];
+} TrialJobs;
+
+//Encodes the sound in a format, and measures the power and peak of the difference after decoding it again
+static void TrialEncodeJob(void *ctx, unsigned f) {
+	TrialJobs *jobs = ctx;
+	DcAudioConverter sound = *jobs->sound;
+	sound.format = trial_formats[f];
+	
+	uint8_t *image;
+	size_t size;
+	jobs->err[f] = fDcaEncode(&sound, &image, &size);
+	if (jobs->err[f] != DCAE_OK)
+		return;
+	const fDcAudioHeader *dca = (const fDcAudioHeader*)image;
+	jobs->size[f] = fDaGetDataSize(dca);
+	
+	const size_t block_frames = DCA_DECODE_BLOCK_SAMPLES / sound.channel_cnt & ~(size_t)1;
+	int16_t decoded[DCA_DECODE_BLOCK_SAMPLES];
+	int16_t *channel_ptrs[DCA_FILE_MAX_CHANNELS];
+	for(unsigned c = 0; c < sound.channel_cnt; c++)
+		channel_ptrs[c] = decoded + c * block_frames;
+	
+	fDcaDecoder dec;
+	fDcaDecoderInit(&dec, dca);
+	double sum = 0;
+	int peak = 0;
+	size_t pos = 0, frames;
+	while ((frames = fDcaDecode(&dec, channel_ptrs, block_frames)) > 0) {
+		for(unsigned c = 0; c < sound.channel_cnt; c++) {
+			for(size_t i = 0; i < frames; i++) {
+				int diff = sound.samples[c][pos + i] - channel_ptrs[c][i];
+				sum += (double)diff * diff;
+				if (abs(diff) > peak)
+					peak = abs(diff);
+			}
+		}
+		pos += frames;
+	}
+	jobs->noise_power[f] = sum / ((double)sound.samples_len * sound.channel_cnt);
+	jobs->peak_error[f] = peak;
+	
+	free(image);
+}
+
+dcaError dcaPlanTrials(const DcAudioConverter *ref, bool lower_rates, bool loop_exact, dcaPlanSound *plan) {
+	assert(ref);
+	assert(plan);
+	assert(ref->samples_len > 0);
+	
+	plan->choice_cnt = 0;
+	
+	dcaSpectrum spec;
+	dcaError err = DCAE_OK;
+	if (lower_rates) {
+		err = dcaAnalyzeSpectrum(ref, &spec);
+		if (err != DCAE_OK)
+			return err;
+	}
+	double ref_power = MeanPower(ref);
+	
+	unsigned rates[1 + sizeof(plan_rates) / sizeof(plan_rates[0])];
+	unsigned rate_cnt = 0;
+	rates[rate_cnt++] = ref->sample_rate_hz;
+	for(unsigned i = 0; lower_rates && i < sizeof(plan_rates) / sizeof(plan_rates[0]); i++) {
+		unsigned rate = fDcaToAICAFrequency(plan_rates[i]);
+		if (rate < rates[rate_cnt - 1])
+			rates[rate_cnt++] = rate;
+	}
+	
+	for(unsigned r = 0; r < rate_cnt && err == DCAE_OK; r++) {
+		//The sound's own rate is tried on the sound itself, the others on a resampled copy
+		DcAudioConverter sound = *ref;
+		double lost_power = 0;
+		if (r > 0) {
+			err = CopySound(&sound, ref);
+			if (err != DCAE_OK)
+				break;
+			//Resampled the same way as the sound that's built from the choice, so the size matches exactly
+			err = dcaResampleSound(&sound, rates[r], loop_exact, true);
+			
+			//Energy above the new Nyquist frequency is gone
+			lost_power = ref_power * dcaSpectrumFractionAbove(&spec, rates[r] / 2.0);
+		}
+		
+		TrialJobs jobs = {.sound = &sound};
+		if (err == DCAE_OK)
+			dcaRunJobs(TRIAL_FORMAT_CNT, TrialEncodeJob, &jobs);
+		
+		for(unsigned f = 0; f < TRIAL_FORMAT_CNT && err == DCAE_OK; f++) {
+			err = jobs.err[f];
+			if (err != DCAE_OK)
+				break;
+			
+			assert(plan->choice_cnt < DCA_PLAN_MAX_CHOICES);
+			dcaPlanChoice *choice = &plan->choices[plan->choice_cnt++];
+			choice->format = trial_formats[f];
+			choice->sample_rate_hz = rates[r];
+			choice->size = jobs.size[f];
+			choice->peak_error = jobs.peak_error[f];
+			//A silent sound has nothing to lose, so every choice counts as lossless
+			double noise = lost_power + jobs.noise_power[f];
+			choice->snr_db = noise > 0 && ref_power > 0 ? 10 * log10(ref_power / noise) : DCA_PLAN_MAX_SNR_DB;
+			if (!(choice->snr_db <= DCA_PLAN_MAX_SNR_DB))
+				choice->snr_db = DCA_PLAN_MAX_SNR_DB;
+			//dcaPlanSolve needs finite scores, or the sound couldn't be placed at all
+			if (choice->snr_db < -DCA_PLAN_MAX_SNR_DB)
+				choice->snr_db = -DCA_PLAN_MAX_SNR_DB;
+			
+			dcaLog(LOG_INFO, "Trial: %s at %u hz, %zu bytes, %.1f dB, peak error %u\n",
+				fDaFormatString(choice->format), choice->sample_rate_hz, choice->size, choice->snr_db, choice->peak_error);
+		}
+		
+		if (r > 0) {
+			for(unsigned c = 0; c < sound.channel_cnt; c++)
+				free(sound.samples[c]);
+		}
+	}
+	
+	if (lower_rates)
+		dcaSpectrumFree(&spec);
+	return err;
+}
+
+bool dcaPlanSolve(dcaPlanSound *sounds, unsigned sound_cnt, size_t budget) {
+	assert(sounds);
+	
+	//Sizes are counted in units, which are rounded up, so the result never goes over budget
+	size_t unit = DCA_ALIGNMENT;
+	while ((budget / unit + 1) * sound_cnt > PLAN_MAX_CELLS)
+		unit *= 2;
+	size_t cap = budget / unit;
+	
+	//best[b] is the highest total for the sounds so far using at most b units, or -INFINITY if they can't fit
+	double *best = malloc((cap + 1) * sizeof(double));
+	double *next = malloc((cap + 1) * sizeof(double));
+	//Choice made for each sound at each budget, to trace the answer back
+	uint8_t *picked = malloc((size_t)sound_cnt * (cap + 1));
+	bool fits = false;
+	if (best == NULL || next == NULL || picked == NULL)
+		goto cleanup;
+	
+	for(size_t b = 0; b <= cap; b++)
+		best[b] = 0;
+	
+	for(unsigned s = 0; s < sound_cnt; s++) {
+		const dcaPlanSound *sound = &sounds[s];
+		uint8_t *pick = picked + (size_t)s * (cap + 1);
+		for(size_t b = 0; b <= cap; b++) {
+			next[b] = -INFINITY;
+			for(unsigned c = 0; c < sound->choice_cnt; c++) {
+				size_t cost = (sound->choices[c].size + unit - 1) / unit;
+				if (cost > b || best[b - cost] == -INFINITY)
+					continue;
+				double total = best[b - cost] + sound->priority * sound->choices[c].snr_db;
+				if (total > next[b]) {
+					next[b] = total;
+					pick[b] = c;
+				}
+			}
+		}
+		double *swap = best;
+		best = next;
+		next = swap;
+	}
+	
+	fits = best[cap] != -INFINITY;
+	if (fits) {
+		size_t b = cap;
+		for(unsigned s = sound_cnt; s-- > 0; ) {
+			unsigned c = picked[(size_t)s * (cap + 1) + b];
+			sounds[s].chosen = c;
+			b -= (sounds[s].choices[c].size + unit - 1) / unit;
+		}
+	}
+	
+cleanup:
+	free(best);
+	free(next);
+	free(picked);
+	return fits;
+}
+
+/*
+	Trial results are slow to make, so they can be kept in a cache file
+	between runs. Each line holds the key of a sound (a hash of its
+	source file and the settings it was converted with), then one of its
+	choices.
+*/
+
+uint64_t dcaHash64(const void *data, size_t size, uint64_t hash) {
+	const uint8_t *d = data;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= d[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+void dcaPlanCacheLoad(dcaPlanCache *cache, const char *fname) {
+	assert(cache);
+	memset(cache, 0, sizeof(*cache));
+	
+	FILE *f = fopen(fname, "r");
+	if (f == NULL)
+		return;
+	
+	char line[128];
+	unsigned long long key;
+	unsigned format, rate, peak;
+	size_t size;
+	float snr;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llx %u %u %zu %f %u", &key, &format, &rate, &size, &snr, &peak) != 6 || format > DCAF_ADPCM)
+			continue;
+		dcaPlanChoice choice = {format, rate, size, snr, peak};
+		dcaPlanCachePut(cache, key, &choice, 1);
+	}
+	fclose(f);
+}
+
+bool dcaPlanCacheGet(const dcaPlanCache *cache, uint64_t key, dcaPlanSound *plan) {
+	assert(cache);
+	plan->choice_cnt = 0;
+	for(size_t i = 0; i < cache->entry_cnt && plan->choice_cnt < DCA_PLAN_MAX_CHOICES; i++)
+		if (cache->entries[i].key == key)
+			plan->choices[plan->choice_cnt++] = cache->entries[i].choice;
+	return plan->choice_cnt > 0;
+}
+
+void dcaPlanCachePut(dcaPlanCache *cache, uint64_t key, const dcaPlanChoice *choices, unsigned choice_cnt) {
+	assert(cache);
+	for(unsigned i = 0; i < choice_cnt; i++) {
+		if (cache->entry_cnt == cache->capacity) {
+			size_t capacity = cache->capacity ? cache->capacity * 2 : 256;
+			void *grown = realloc(cache->entries, capacity * sizeof(cache->entries[0]));
+			if (grown == NULL)
+				return;
+			cache->entries = grown;
+			cache->capacity = capacity;
+		}
+		cache->entries[cache->entry_cnt].key = key;
+		cache->entries[cache->entry_cnt].choice = choices[i];
+		cache->entry_cnt++;
+	}
+}
+
+dcaError dcaPlanCacheSave(const dcaPlanCache *cache, const char *fname) {
+	assert(cache);
+	
+	//Each line is at most about 80 characters
+	char *text = malloc(cache->entry_cnt * 96 + 1);
+	if (text == NULL)
+		return DCAE_OUT_OF_MEMORY;
+	size_t len = 0;
+	for(size_t i = 0; i < cache->entry_cnt; i++) {
+		const dcaPlanChoice *c = &cache->entries[i].choice;
+		len += sprintf(text + len, "%016llx %u %u %zu %.3f %u\n", (unsigned long long)cache->entries[i].key,
+			c->format, c->sample_rate_hz, c->size, c->snr_db, c->peak_error);
+	}
+	
+	dcaError retval = dcaWriteFile(fname, text, len);
+	free(text);
+	return retval;
+}
+
+void dcaPlanCacheFree(dcaPlanCache *cache) {
+	assert(cache);
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
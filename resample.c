@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "dca_conv.h"
+#include "samplerate.h"
+#include "cpu.h"
+
+/*
+	Resampling is done in fixed size chunks, so the only extra memory
+	needed on top of the input and output samples is libsamplerate's
+	filter state plus these small buffers. The size is in samples, and
+	is shared between all channels.
+*/
+#define RESAMPLE_CHUNK_SAMPLES	4096
+
+/*
+	When downsampling by at least this much, the automatic resampler
+	selection uses the FFT resampler instead of libsamplerate's sinc
+	converter.
+*/
+#define FFT_RESAMPLE_MAX_RATIO	0.25
+
+/*
+	Input samples either side of an output sample that affect it, in zero
+	crossings of the filter, which are stretched out when downsampling.
+	libsamplerate's best sinc filter reaches about 143 zero crossings each
+	way, and the FFT resampler's anti-aliasing filter less than 100.
+*/
+#define RESAMPLE_CONTEXT_ZEROS	160
+
+dcaError dcaResampleFft(DcAudioConverter *dcac, double ratio, size_t new_size);
+
+/*
+	Resamples all channels at once. libsamplerate has kernels specialised
+	for each channel count, which share the filter coefficient calculation
+	between channels, so this is faster than resampling one channel at a
+	time. Samples are interleaved into small buffers a chunk at a time.
+	dst[] must have space for dst_len samples per channel.
+*/
+static dcaError ResampleInterleaved(SRC_STATE *src, double ratio, int16_t * const *src_samples, unsigned channels, size_t src_len, int16_t **dst, size_t dst_len) {
+	const size_t chunk_frames = RESAMPLE_CHUNK_SAMPLES / channels;
+	int16_t interleaved[RESAMPLE_CHUNK_SAMPLES];
+	float in_float[RESAMPLE_CHUNK_SAMPLES];
+	float out_float[RESAMPLE_CHUNK_SAMPLES];
+	size_t in_pos = 0, out_pos = 0;
+
+	SRC_DATA srcd;
+	memset(&srcd, 0, sizeof(srcd));
+	srcd.src_ratio = ratio;
+
+	while (out_pos < dst_len) {
+		//Refill input buffer once the previous chunk has been consumed
+		if (srcd.input_frames == 0 && !srcd.end_of_input) {
+			size_t cnt = src_len - in_pos;
+			if (cnt > chunk_frames)
+				cnt = chunk_frames;
+			dcaCpu.interleave(interleaved, src_samples, channels, in_pos, cnt);
+			src_short_to_float_array(interleaved, in_float, cnt * channels);
+			in_pos += cnt;
+
+			srcd.data_in = in_float;
+			srcd.input_frames = cnt;
+			srcd.end_of_input = in_pos == src_len;
+		}
+
+		size_t out_cnt = dst_len - out_pos;
+		if (out_cnt > chunk_frames)
+			out_cnt = chunk_frames;
+		srcd.data_out = out_float;
+		srcd.output_frames = out_cnt;
+
+		int src_err = src_process(src, &srcd);
+		if (src_err) {
+			dcaLog(LOG_WARNING, "Sample rate conversion error (%s)\n", src_strerror(src_err));
+			return DCAE_RESAMPLE_ERROR;
+		}
+
+		size_t gen = srcd.output_frames_gen;
+		src_float_to_short_array(out_float, interleaved, gen * channels);
+		dcaCpu.deinterleave(dst, out_pos, interleaved, channels, gen);
+		out_pos += gen;
+
+		srcd.data_in += srcd.input_frames_used * channels;
+		srcd.input_frames -= srcd.input_frames_used;
+
+		//Resampler is drained
+		if (srcd.end_of_input && gen == 0)
+			break;
+	}
+
+	//If the resampler came up short, pad with silence so the length matches the ratio
+	if (out_pos < dst_len)
+		for(unsigned c = 0; c < channels; c++)
+			memset(dst[c] + out_pos, 0, (dst_len - out_pos) * sizeof(int16_t));
+
+	return DCAE_OK;
+}
+
+static dcaError ResampleSinc(DcAudioConverter *dcac, double ratio, size_t new_size) {
+	int src_err = 0;
+	SRC_STATE *src = src_new(SRC_SINC_BEST_QUALITY, dcac->channel_cnt, &src_err);
+	if (src == NULL) {
+		dcaLog(LOG_WARNING, "Sample rate conversion error (%s)\n", src_strerror(src_err));
+		return DCAE_RESAMPLE_ERROR;
+	}
+
+	int16_t *newsamples[DCAC_MAX_CHANNELS] = {0};
+	dcaError retval = DCAE_OK;
+	for(unsigned c = 0; c < dcac->channel_cnt && retval == DCAE_OK; c++) {
+		newsamples[c] = malloc(new_size * sizeof(int16_t));
+		if (newsamples[c] == NULL)
+			retval = DCAE_OUT_OF_MEMORY;
+	}
+
+	if (retval == DCAE_OK)
+		retval = ResampleInterleaved(src, ratio, dcac->samples, dcac->channel_cnt, dcac->samples_len, newsamples, new_size);
+
+	//Only replace the channels once every one of them was resampled, so a failure leaves the sound as it was
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		if (retval == DCAE_OK) {
+			dcaFreeChannel(dcac, c);
+			dcac->samples[c] = newsamples[c];
+		} else {
+			free(newsamples[c]);
+		}
+	}
+
+	src_delete(src);
+
+	return retval;
+}
+
+//Resamples every channel to new_size samples with the resampler dcac asks for. Doesn't change anything else.
+static dcaError ResampleChannels(DcAudioConverter *dcac, double ratio, size_t new_size, unsigned new_rate_hz) {
+	dcaResampler resampler = dcac->resampler;
+	if (resampler == DCAR_AUTO)
+		resampler = ratio <= FFT_RESAMPLE_MAX_RATIO ? DCAR_FFT : DCAR_SINC;
+	if (resampler == DCAR_FFT && ratio >= 1) {
+		dcaLog(LOG_WARNING, "\nFFT resampler only supports downsampling, using sinc resampler\n");
+		resampler = DCAR_SINC;
+	}
+
+	dcaLog(LOG_PROGRESS, "\nConverting input sample rate from %u hz to %u hz (%s resampler)\n",
+		dcac->sample_rate_hz, new_rate_hz, resampler == DCAR_FFT ? "FFT" : "sinc");
+
+	return resampler == DCAR_FFT ?
+		dcaResampleFft(dcac, ratio, new_size) :
+		ResampleSinc(dcac, ratio, new_size);
+}
+
+dcaError dcaResample(DcAudioConverter *dcac, unsigned new_rate_hz) {
+	assert(dcac);
+	assert(dcac->channel_cnt > 0);
+	assert(new_rate_hz > 0);
+
+	if (new_rate_hz == dcac->sample_rate_hz)
+		return DCAE_OK;
+
+	float ratio = (float)new_rate_hz / dcac->sample_rate_hz;
+	size_t new_size = dcac->samples_len * ratio;
+
+	dcaError retval = ResampleChannels(dcac, ratio, new_size, new_rate_hz);
+	if (retval != DCAE_OK)
+		return retval;
+
+	dcac->sample_rate_hz = new_rate_hz;
+	dcac->samples_len = new_size;
+	//Letting it just truncate so that loop_end can't possibly go past the end
+	dcac->loop_start *= ratio;
+	dcac->loop_end *= ratio;
+
+	return DCAE_OK;
+}
+
+static void FreeChannels(int16_t **samples, unsigned cnt) {
+	for(unsigned c = 0; c < cnt; c++)
+		free(samples[c]);
+}
+
+/*
+	Resamples a looping sound as it's played: the part before the loop,
+	followed by the loop body repeating forever.
+
+	The ratio is adjusted so the loop becomes a whole number of samples,
+	which means the output loop is exactly one period of the resampled
+	repeating signal, and the rate moves by at most half a sample per
+	loop. The part before the loop is resampled with the loop following
+	it, as it's heard. The loop body is taken from a later repeat, where
+	the filter sees the end of the loop before the start and the start of
+	the loop after the end, just like when it wraps around on the AICA.
+
+	Everything is resampled in one pass over a copy of the sound with the
+	loop repeated just far enough for that. The first part of the output
+	loop comes from a repeat that has the end of the loop before it, and
+	the rest from the repeat before, where the filter no longer reaches
+	back into the part before the loop. So unless the loop is shorter than
+	the filter, the loop body only goes through the resampler once, plus a
+	little filter context. Anything after the loop end is never played,
+	so it's dropped.
+*/
+dcaError dcaResampleLoop(DcAudioConverter *dcac, unsigned new_rate_hz) {
+	assert(dcac);
+	assert(dcac->channel_cnt > 0);
+	assert(new_rate_hz > 0);
+	assert(dcac->looping);
+	assert(dcac->loop_start < dcac->loop_end && dcac->loop_end <= dcac->samples_len);
+
+	if (new_rate_hz == dcac->sample_rate_hz)
+		return DCAE_OK;
+
+	const size_t start = dcac->loop_start, loop_len = dcac->loop_end - dcac->loop_start;
+	size_t out_loop_len = llrint((double)loop_len * new_rate_hz / dcac->sample_rate_hz);
+	if (out_loop_len == 0)
+		out_loop_len = 1;
+	const double ratio = (double)out_loop_len / loop_len;
+	//Output sample out_start is at or just after the loop start
+	const size_t out_start = ((uint64_t)start * out_loop_len + loop_len - 1) / loop_len;
+
+	//Repeats needed before the one the loop start comes from, for the filter not to reach back before the loop
+	const size_t context = ceil(RESAMPLE_CONTEXT_ZEROS / (ratio < 1 ? ratio : 1));
+	const size_t repeats = (context + loop_len - 1) / loop_len;
+	size_t split = ceil((context - (repeats - 1) * loop_len) * ratio) + 2;
+	if (split > out_loop_len)
+		split = out_loop_len;
+	const size_t needed = out_start + repeats * out_loop_len + split;
+	const size_t stream_len = ceil(needed / ratio) + context + 2;
+	const size_t stream_out = stream_len * ratio;
+	assert(stream_out >= needed);
+
+	//The stream is resampled in a separate converter, and everything is allocated before any channel of the
+	//sound is replaced, so a failure leaves the sound as it was
+	DcAudioConverter stream = *dcac;
+	stream.borrowed_channels = 0;
+	stream.samples_len = stream_len;
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		stream.samples[c] = malloc(stream_len * sizeof(int16_t));
+		if (stream.samples[c] == NULL) {
+			FreeChannels(stream.samples, c);
+			return DCAE_OUT_OF_MEMORY;
+		}
+		memcpy(stream.samples[c], dcac->samples[c], start * sizeof(int16_t));
+		for(size_t pos = start; pos < stream_len; pos += loop_len) {
+			size_t cnt = stream_len - pos < loop_len ? stream_len - pos : loop_len;
+			memcpy(stream.samples[c] + pos, dcac->samples[c] + start, cnt * sizeof(int16_t));
+		}
+	}
+
+	dcaError retval = ResampleChannels(&stream, ratio, stream_out, new_rate_hz);
+	if (retval != DCAE_OK) {
+		FreeChannels(stream.samples, stream.channel_cnt);
+		return retval;
+	}
+
+	const size_t new_size = out_start + out_loop_len;
+	int16_t *newsamples[DCAC_MAX_CHANNELS] = {0};
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		newsamples[c] = malloc(new_size * sizeof(int16_t));
+		if (newsamples[c] == NULL) {
+			FreeChannels(newsamples, c);
+			FreeChannels(stream.samples, stream.channel_cnt);
+			return DCAE_OUT_OF_MEMORY;
+		}
+	}
+
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		const int16_t *resampled = stream.samples[c];
+		memcpy(newsamples[c], resampled, out_start * sizeof(int16_t));
+		memcpy(newsamples[c] + out_start, resampled + out_start + repeats * out_loop_len, split * sizeof(int16_t));
+		memcpy(newsamples[c] + out_start + split, resampled + out_start + (repeats - 1) * out_loop_len + split,
+			(out_loop_len - split) * sizeof(int16_t));
+		dcaFreeChannel(dcac, c);
+		dcac->samples[c] = newsamples[c];
+	}
+	FreeChannels(stream.samples, stream.channel_cnt);
+
+	dcaLog(LOG_INFO, "Loop of %zu samples becomes %zu samples, for a rate of %.2f hz\n",
+		loop_len, out_loop_len, dcac->sample_rate_hz * ratio);
+
+	dcac->sample_rate_hz = lrint(dcac->sample_rate_hz * ratio);
+	dcac->samples_len = new_size;
+	dcac->loop_start = out_start;
+	dcac->loop_end = new_size;
+
+	return DCAE_OK;
+}
+
+dcaError dcaResampleSound(DcAudioConverter *dcac, unsigned new_rate_hz, bool loop_exact, bool aica_rate) {
+	assert(dcac);
+
+	if (!loop_exact || !dcac->looping || dcac->loop_start >= dcac->loop_end)
+		return dcaResample(dcac, new_rate_hz);
+
+	dcaError retval = dcaResampleLoop(dcac, new_rate_hz);
+	//The rate was nudged to fit the loop, so round it again to one the AICA can play
+	if (retval == DCAE_OK && aica_rate)
+		dcac->sample_rate_hz = fDcaToAICAFrequency(dcac->sample_rate_hz);
+	return retval;
+}
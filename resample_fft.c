@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "dca_conv.h"
+#include "fft.h"
+#include "cpu.h"
+
+/*
+	Frequency domain resampler for large downsampling ratios.
+
+	Resampling is done in two stages. First, the input is low-pass
+	filtered at the input rate with a long linear phase FIR filter, using
+	FFT overlap-save convolution. Two blocks are filtered per transform by
+	placing them in the real and imaginary parts of the input, which works
+	because the filter is real.
+
+	The filtered signal contains nothing above the output Nyquist
+	frequency, so it's heavily oversampled relative to the output rate.
+	The second stage only needs a short windowed sinc to interpolate the
+	output samples, and the length of that filter does not depend on the
+	ratio.
+
+	With time domain sinc resampling, the filter grows longer as the
+	ratio drops, while the cost of the FFT stage only grows with the log
+	of the filter length.
+*/
+
+//Stopband attenuation of both filter stages
+#define FFT_RS_ATTENUATION_DB	120.0
+//Passband edge of the anti-aliasing filter, as a fraction of the output Nyquist frequency
+#define FFT_RS_PASSBAND	0.92
+//Resolution of the interpolation kernel table, in entries per input sample
+#define FFT_RS_KERNEL_PHASES	1024
+
+typedef struct {
+	double ratio;
+
+	dcaFft fft;
+	//Anti-aliasing filter length in taps (always odd) and its frequency response
+	unsigned filter_len;
+	dcaComplex *filter_resp;
+	//New filtered samples produced per block
+	unsigned block_len;
+	dcaComplex *work;
+
+	//Interpolation kernel, covering distances 0 to kernel_half
+	unsigned kernel_half;
+	float *kernel;
+	//Kernel evaluated for the current output sample
+	float *weights;
+
+	//Filtered samples waiting to be interpolated
+	float *filtered;
+} FftResampler;
+
+static double BesselI0(double x) {
+	double sum = 1, term = 1;
+	for(unsigned k = 1; k < 64; k++) {
+		term *= (x / (2*k)) * (x / (2*k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static double KaiserBeta(double attenuation_db) {
+	if (attenuation_db > 50)
+		return 0.1102 * (attenuation_db - 8.7);
+	if (attenuation_db >= 21)
+		return 0.5842 * pow(attenuation_db - 21, 0.4) + 0.07886 * (attenuation_db - 21);
+	return 0;
+}
+
+//x is the position in the window, from -1 to 1
+static double Kaiser(double x, double beta) {
+	if (x <= -1 || x >= 1)
+		return 0;
+	return BesselI0(beta * sqrt(1 - x*x)) / BesselI0(beta);
+}
+
+static double Sinc(double x) {
+	if (fabs(x) < 1e-12)
+		return 1;
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+//Number of taps needed for a Kaiser window filter with the given transition width, in cycles per sample
+static unsigned KaiserLength(double transition_width) {
+	return ceil((FFT_RS_ATTENUATION_DB - 8) / (2.285 * 2 * M_PI * transition_width)) + 1;
+}
+
+static void FftResamplerFree(FftResampler *rs) {
+	dcaFftFree(&rs->fft);
+	free(rs->filter_resp);
+	free(rs->work);
+	free(rs->kernel);
+	free(rs->weights);
+	free(rs->filtered);
+	memset(rs, 0, sizeof(*rs));
+}
+
+static bool FftResamplerInit(FftResampler *rs, double ratio) {
+	assert(ratio > 0 && ratio < 1);
+	memset(rs, 0, sizeof(*rs));
+	rs->ratio = ratio;
+
+	double beta = KaiserBeta(FFT_RS_ATTENUATION_DB);
+
+	//Anti-aliasing filter. The stopband starts at the output Nyquist frequency.
+	double stop = 0.5 * ratio;
+	double pass = stop * FFT_RS_PASSBAND;
+	double cutoff = (pass + stop) / 2;
+	unsigned len = KaiserLength(stop - pass) | 1;
+	rs->filter_len = len;
+
+	//Make the FFT large enough that most of each block is new output
+	unsigned fftsize = dcaFftSizeFor(4 * len);
+	if (fftsize < 1024)
+		fftsize = 1024;
+	if (!dcaFftInit(&rs->fft, fftsize))
+		goto error;
+	rs->block_len = fftsize - (len - 1);
+
+	rs->filter_resp = calloc(fftsize, sizeof(dcaComplex));
+	rs->work = malloc(fftsize * sizeof(dcaComplex));
+	if (rs->filter_resp == NULL || rs->work == NULL)
+		goto error;
+
+	double center = (len - 1) / 2.0, sum = 0;
+	for(unsigned i = 0; i < len; i++) {
+		double tap = 2 * cutoff * Sinc(2 * cutoff * (i - center)) * Kaiser((i - center) / (center + 1), beta);
+		rs->filter_resp[i].re = tap;
+		sum += tap;
+	}
+	//Normalize to unity gain, and fold in the scaling of the inverse transform
+	for(unsigned i = 0; i < len; i++)
+		rs->filter_resp[i].re /= sum * fftsize;
+	dcaFftForward(&rs->fft, rs->filter_resp);
+
+	//Interpolation kernel. After filtering, the passband ends at pass and the first image starts
+	//at 1-pass, so the transition can be centered on the input Nyquist frequency.
+	unsigned taps = KaiserLength(1 - 2 * pass);
+	rs->kernel_half = (taps + 1) / 2;
+	unsigned kernel_entries = rs->kernel_half * FFT_RS_KERNEL_PHASES + 2;
+	rs->kernel = malloc(kernel_entries * sizeof(float));
+	rs->weights = malloc(2 * rs->kernel_half * sizeof(float));
+	if (rs->kernel == NULL || rs->weights == NULL)
+		goto error;
+	for(unsigned i = 0; i < kernel_entries; i++) {
+		double x = (double)i / FFT_RS_KERNEL_PHASES;
+		rs->kernel[i] = Sinc(x) * Kaiser(x / rs->kernel_half, beta);
+	}
+
+	rs->filtered = malloc((2 * rs->block_len + 2 * rs->kernel_half) * sizeof(float));
+	if (rs->filtered == NULL)
+		goto error;
+
+	dcaLog(LOG_INFO, "FFT resampler: %u tap filter, %u point FFT, %u tap interpolation\n",
+		len, fftsize, 2 * rs->kernel_half);
+
+	return true;
+
+error:
+	FftResamplerFree(rs);
+	return false;
+}
+
+//Copies src[pos] to src[pos+cnt] into dst, with zeros for anything outside of the input
+static void LoadSegment(float *dst, size_t stride, const int16_t *src, size_t src_len, long long pos, unsigned cnt) {
+	for(unsigned i = 0; i < cnt; i++, pos++) {
+		dst[i * stride] = (pos >= 0 && pos < (long long)src_len) ? src[pos] : 0;
+	}
+}
+
+static inline float KernelAt(const FftResampler *rs, double x) {
+	x = fabs(x) * FFT_RS_KERNEL_PHASES;
+	unsigned i = x;
+	float f = x - i;
+	return rs->kernel[i] + f * (rs->kernel[i+1] - rs->kernel[i]);
+}
+
+static void FftResamplerProcess(FftResampler *rs, const int16_t *src, size_t src_len, int16_t *dst, size_t dst_len) {
+	const unsigned fftsize = rs->fft.size;
+	const unsigned block = rs->block_len;
+	const unsigned half = rs->kernel_half;
+	const long long delay = (rs->filter_len - 1) / 2;
+
+	//Absolute position of the first sample in rs->filtered. Filtered samples before
+	//the start of the input are needed by the interpolator for the first outputs.
+	long long filtered_start = -(long long)half;
+	unsigned filtered_cnt = 0;
+	long long next_block = filtered_start;
+	size_t out_pos = 0;
+
+	while (out_pos < dst_len) {
+		//Filter the next two blocks at once, one in the real part and one in the imaginary part
+		long long seg = next_block - delay;
+		LoadSegment(&rs->work[0].re, 2, src, src_len, seg, fftsize);
+		LoadSegment(&rs->work[0].im, 2, src, src_len, seg + block, fftsize);
+
+		dcaFftForward(&rs->fft, rs->work);
+		dcaCpu.complex_multiply(rs->work, rs->filter_resp, fftsize);
+		dcaFftInverse(&rs->fft, rs->work);
+
+		//The first filter_len-1 results of each block are wrapped around and are discarded
+		float *out = rs->filtered + filtered_cnt;
+		for(unsigned i = 0; i < block; i++) {
+			out[i] = rs->work[rs->filter_len - 1 + i].re;
+			out[block + i] = rs->work[rs->filter_len - 1 + i].im;
+		}
+		filtered_cnt += 2 * block;
+		next_block += 2 * block;
+
+		//Interpolate every output sample that has all the filtered samples it needs
+		long long filtered_end = filtered_start + filtered_cnt;
+		for(; out_pos < dst_len; out_pos++) {
+			double t = out_pos / rs->ratio;
+			long long center = floor(t);
+			if (center + half >= filtered_end)
+				break;
+			double frac = t - center;
+
+			for(unsigned j = 0; j < 2 * half; j++)
+				rs->weights[j] = KernelAt(rs, frac + half - 1 - j);
+			const float *f = rs->filtered + (center - filtered_start) + 1 - half;
+			float acc = dcaCpu.dot(f, rs->weights, 2 * half);
+
+			long val = lrintf(acc);
+			if (val > 32767)
+				val = 32767;
+			else if (val < -32768)
+				val = -32768;
+			dst[out_pos] = val;
+		}
+
+		//Keep enough history for the next output
+		unsigned keep = 2 * half;
+		memmove(rs->filtered, rs->filtered + filtered_cnt - keep, keep * sizeof(float));
+		filtered_start += filtered_cnt - keep;
+		filtered_cnt = keep;
+	}
+}
+
+dcaError dcaResampleFft(DcAudioConverter *dcac, double ratio, size_t new_size) {
+	FftResampler rs;
+	if (!FftResamplerInit(&rs, ratio))
+		return DCAE_RESAMPLE_ERROR;
+
+	//Every output channel is allocated before any is replaced, so running out of memory leaves the sound as it was
+	int16_t *newsamples[DCAC_MAX_CHANNELS] = {0};
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		newsamples[c] = malloc(new_size * sizeof(int16_t));
+		if (newsamples[c] == NULL) {
+			for(unsigned i = 0; i < c; i++)
+				free(newsamples[i]);
+			FftResamplerFree(&rs);
+			return DCAE_OUT_OF_MEMORY;
+		}
+	}
+
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		FftResamplerProcess(&rs, dcac->samples[c], dcac->samples_len, newsamples[c], new_size);
+
+		dcaFreeChannel(dcac, c);
+		dcac->samples[c] = newsamples[c];
+	}
+
+	FftResamplerFree(&rs);
+
+	return DCAE_OK;
+}
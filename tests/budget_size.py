@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# Checks that banks built by --budget hold exactly the sample data the plan printed, with and
+# without --loop-resample, which changes the length of every resampled sound.
+#
+# Usage: budget_size.py path/to/dcaconv
+
+import math
+import os
+import random
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import wave
+
+# Enough budgets that most of the trials get picked by one of them
+BUDGETS = ["%dK" % k for k in range(25, 125, 5)]
+# Sample rate and length of each sound
+LENGTHS = [(44100, 57330), (44100, 60417), (32000, 35200), (44100, 39690), (22050, 31972)]
+
+# Looping sounds of different lengths, with tones whose periods aren't a whole number of samples
+def WriteSounds(dir):
+	rng = random.Random(1234)
+	names = []
+	for i, (rate, length) in enumerate(LENGTHS):
+		name = os.path.join(dir, "lp%d.wav" % i)
+		freq = 220 * (i + 1) + 13.7
+		frames = bytearray()
+		for n in range(length):
+			x = 0.4 * math.sin(2 * math.pi * freq * n / rate) + 0.05 * rng.uniform(-1, 1)
+			frames += struct.pack("<h", int(x * 32767))
+		with wave.open(name, "wb") as w:
+			w.setnchannels(1)
+			w.setsampwidth(2)
+			w.setframerate(rate)
+			w.writeframes(bytes(frames))
+		names.append(name)
+	return names
+
+# Sum of the padded channel sizes of every sound in a bank, before any sharing
+def BankDataBytes(fname):
+	with open(fname, "rb") as f:
+		bank = f.read()
+	fourcc, chunk_size, version, entry_cnt, slot_cnt, entries_offset, channels_offset, data_offset = \
+		struct.unpack_from("<4sIB3xHHIII", bank, 0)
+	assert fourcc == b"DcAB", "%s isn't a bank" % fname
+	total = 0
+	for i in range(entry_cnt):
+		name_hash, flags, rate, length, loop_start, loop_end, channel_size, first_channel = \
+			struct.unpack_from("<IHHIIIII", bank, entries_offset + i * 32)
+		total += channel_size * (flags & 0x7)
+	return total
+
+def main():
+	dcaconv = os.path.abspath(sys.argv[1])
+	failed = 0
+	with tempfile.TemporaryDirectory() as dir:
+		sounds = WriteSounds(dir)
+		bank = os.path.join(dir, "out.dcb")
+		# Trials only change with the options, so the cache saves redoing them for each budget
+		cache = os.path.join(dir, "plan.cache")
+		for extra in [[], ["--loop-resample"]]:
+			for budget in BUDGETS:
+				args = [dcaconv, "--budget", budget, "--plan-cache", cache, "-l", "-s", "1234"] + extra + sounds + ["-o", bank]
+				result = subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+				desc = " ".join(["--budget", budget] + extra)
+				if result.returncode != 0:
+					print("FAIL %s: exit code %d\n%s" % (desc, result.returncode, result.stderr))
+					failed += 1
+					continue
+				planned = int(re.search(r"^Total: (\d+) of", result.stdout, re.M).group(1))
+				written = BankDataBytes(bank)
+				if planned != written:
+					print("FAIL %s: planned %d bytes, bank has %d" % (desc, planned, written))
+					failed += 1
+				else:
+					print("ok %s: %d bytes" % (desc, written))
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
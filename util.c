@@ -3,20 +3,107 @@
 #include <assert.h>
 
 #include "dca_conv.h"
+#include "cpu.h"
 
 #define SAFE_FREE(ptr) \
 	if (*(ptr) != NULL) { free(*(ptr)); *(ptr) = NULL; }
 
 void dcaDeinterleaveSamples(DcAudioConverter *dcac, int16_t *samples, unsigned sample_cnt, unsigned channels) {
-	for(unsigned i = 0; i < channels; i++) {
-		int16_t *dst = malloc(sample_cnt * sizeof(int16_t));
-		int16_t *src = samples + i;
-		dcac->samples[i] = dst;
-		
-		for(unsigned j = 0; j < sample_cnt; j++) {
-			dst[j] = src[j*channels];
+	for(unsigned i = 0; i < channels; i++)
+		dcac->samples[i] = malloc(sample_cnt * sizeof(int16_t));
+	dcaCpu.deinterleave(dcac->samples, 0, samples, channels, sample_cnt);
+}
+
+dcaError dcaInitSamples(DcAudioConverter *dcac, unsigned channels, size_t capacity) {
+	assert(dcac);
+	if (channels == 0 || channels > DCAC_MAX_CHANNELS)
+		return DCAE_TOO_MANY_CHANNELS;
+	
+	if (capacity == 0)
+		capacity = DCA_DECODE_BLOCK_SAMPLES;
+	
+	dcac->channel_cnt = channels;
+	dcac->samples_len = 0;
+	dcac->samples_capacity = capacity;
+	for(unsigned c = 0; c < channels; c++) {
+		dcac->samples[c] = malloc(capacity * sizeof(int16_t));
+		if (dcac->samples[c] == NULL) {
+			for(unsigned i = 0; i < c; i++)
+				SAFE_FREE(dcac->samples + i);
+			return DCAE_OUT_OF_MEMORY;
 		}
 	}
+	return DCAE_OK;
+}
+
+dcaError dcaAppendInterleaved(DcAudioConverter *dcac, const int16_t *samples, size_t frames) {
+	assert(dcac);
+	
+	if (dcac->samples_len + frames > dcac->samples_capacity) {
+		size_t capacity = dcac->samples_capacity * 2;
+		if (capacity < dcac->samples_len + frames)
+			capacity = dcac->samples_len + frames;
+		for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+			int16_t *grown = realloc(dcac->samples[c], capacity * sizeof(int16_t));
+			if (grown == NULL)
+				return DCAE_OUT_OF_MEMORY;
+			dcac->samples[c] = grown;
+		}
+		dcac->samples_capacity = capacity;
+	}
+	
+	dcaCpu.deinterleave(dcac->samples, dcac->samples_len, samples, dcac->channel_cnt, frames);
+	dcac->samples_len += frames;
+	return DCAE_OK;
+}
+
+static uint64_t PositionToSamples(dcaPosition pos, unsigned rate_hz) {
+	double samples = pos.seconds ? pos.value * rate_hz : pos.value;
+	return samples > 0 ? (uint64_t)(samples + 0.5) : 0;
+}
+
+void dcaGetRange(const DcAudioConverter *dcac, unsigned rate_hz, uint64_t *start, uint64_t *end) {
+	assert(dcac);
+	
+	*start = PositionToSamples(dcac->range_start, rate_hz);
+	*end = PositionToSamples(dcac->range_end, rate_hz);
+	if (*end == 0)
+		*end = UINT64_MAX;
+}
+
+dcaError dcaAppendInterleavedRange(DcAudioConverter *dcac, const int16_t *samples, size_t frames, uint64_t pos, uint64_t start, uint64_t end) {
+	if (pos + frames <= start || pos >= end)
+		return DCAE_OK;
+	
+	size_t skip = pos < start ? start - pos : 0;
+	if (pos + frames > end)
+		frames = end - pos;
+	return dcaAppendInterleaved(dcac, samples + skip * dcac->channel_cnt, frames - skip);
+}
+
+void dcaFinishSamples(DcAudioConverter *dcac) {
+	assert(dcac);
+	
+	if (dcac->samples_len == dcac->samples_capacity || dcac->samples_len == 0)
+		return;
+	
+	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
+		int16_t *shrunk = realloc(dcac->samples[c], dcac->samples_len * sizeof(int16_t));
+		if (shrunk != NULL)
+			dcac->samples[c] = shrunk;
+	}
+	dcac->samples_capacity = dcac->samples_len;
+}
+
+void dcaFreeChannel(DcAudioConverter *dcac, unsigned channel) {
+	assert(dcac);
+	assert(channel < DCAC_MAX_CHANNELS);
+	
+	if (dcac->borrowed_channels & (1u << channel))
+		dcac->samples[channel] = NULL;
+	else
+		SAFE_FREE(dcac->samples + channel);
+	dcac->borrowed_channels &= ~(1u << channel);
 }
 
 void dcaDownmixMono(DcAudioConverter *dcac) {
@@ -33,17 +120,11 @@ void dcaDownmixMono(DcAudioConverter *dcac) {
 	
 	//Average channels together
 	int16_t *newsamples = malloc(dcaSizeSamplesBytes(dcac));
-	for(unsigned i = 0; i < dcac->samples_len; i++) {
-		int val = 0;
-		for(unsigned c = 0; c < dcac->channel_cnt; c++) {
-			val += dcac->samples[c][i];
-		}
-		newsamples[i] = val / dcac->channel_cnt;
-	}
+	dcaCpu.downmix(newsamples, dcac->samples, dcac->channel_cnt, dcac->samples_len);
 	
 	//Free old samples
 	for(unsigned c = 0; c < dcac->channel_cnt; c++) {
-		SAFE_FREE(dcac->samples + c);
+		dcaFreeChannel(dcac, c);
 	}
 	
 	//Add new samples to sound
@@ -94,6 +175,11 @@ const char * dcaErrorString(dcaError error) {
 		[DCAE_TOO_LONG] = "Sound is too long",
 		[DCAE_READ_ERROR] = "Error while reading file",
 		[DCAE_WRITE_ERROR] = "Error while writing file",
+		[DCAE_RESAMPLE_ERROR] = "Error while resampling",
+		[DCAE_OUT_OF_MEMORY] = "Out of memory",
+		[DCAE_BAD_RANGE] = "Range is past the end of the file",
+		[DCAE_DUPLICATE_NAME] = "Two sounds have the same name",
+		[DCAE_TOO_MANY_SOUNDS] = "Too many sounds for one bank",
 		[DCAE_UNKNOWN] = "Unknown error",
 	};
 	
@@ -97,6 +97,9 @@ void pcm2adpcm(unsigned char *dst, const short *src, size_t length) {
 }
 
 
+void adpcm2pcm_continue(short *dst, const unsigned char *src, size_t length, int *signal_io, int *step_io);
+
+
 /*
     In the original wav2adpcm, length was the length of src in bytes. Since 
     there were two samples per byte, it was impossible to write an odd number 
@@ -104,9 +107,20 @@ void pcm2adpcm(unsigned char *dst, const short *src, size_t length) {
     Now it is the number of samples to convert.
 */
 void adpcm2pcm(short *dst, const unsigned char *src, size_t length) {
+    int signal = 0, step = 0x7f;
+    adpcm2pcm_continue(dst, src, length, &signal, &step);
+}
+
+/*
+    Decodes like adpcm2pcm, starting from and updating the decoder state in 
+    signal and step, so a channel can be decoded a piece at a time. Every 
+    piece but the last must be an even number of samples, so the next one 
+    starts on a whole byte.
+*/
+void adpcm2pcm_continue(short *dst, const unsigned char *src, size_t length, int *signal_io, int *step_io) {
     int signal, step;
-    signal = 0;
-    step = 0x7f;
+    signal = *signal_io;
+    step = *step_io;
 
     do {
         int data, val;
@@ -141,6 +155,9 @@ void adpcm2pcm(short *dst, const unsigned char *src, size_t length) {
 
     }
     while(--length);
+
+    *signal_io = signal;
+    *step_io = step;
 }
 
 void deinterleave(void *buffer, size_t size) {